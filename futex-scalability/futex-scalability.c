@@ -40,9 +40,14 @@
  *     10000        231K        85.65    13.63    0.70
  *     100000       237K        87.53    12.45    0.01
  *
- *  Usage: gcc -O2 -o futex-scalability futex-scalability.c -lpthread
+ *  Usage: gcc -O2 -o futex-scalability futex-scalability.c -lpthread -lm
  *
  *        ./futex-scalability -t <number of seconds to run> -n <nr threads> -c <critical section period in ns> -r <fwait CAS retry count>
+ *                            [-l <lock implementation>]
+ *
+ *  The lock guarding the critical section can be one of fwait (default),
+ *  drepper, pthread, pthread-adaptive, spinlock, ticket, mcs, mcs-park,
+ *  clh, clh-park, cohort, pi or pthread-pi. See --help.
  *
  * Example:
  * $./futex-scalability -t 60 -n 4 -c 1000 -r 1
@@ -84,6 +89,10 @@
 #include <linux/futex.h>
 #include <sys/ioctl.h>
 #include <errno.h>
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <math.h>
 
 /* Uncomment this if you need verbose prints */
 //#define DEBUG
@@ -97,15 +106,44 @@
 #define barrier() __asm__ __volatile__("": : :"memory")
 
 
+#define gettid()  syscall(SYS_gettid)
+
 #define likely(x)       __builtin_expect((x),1)
 #define unlikely(x)     __builtin_expect((x),0)
 
+/* Large enough for x86 (64 bytes) as well as POWER (128 bytes) */
+#define CACHELINE_SIZE	128
+#define __cacheline_aligned __attribute__((aligned(CACHELINE_SIZE)))
+
+#define MAX_THREADS 2048
+int nr_threads = 4;
+
+/* Global timeout : Default 10 seconds */
+unsigned long timeout = 10;
+
+/* Global variable indicating that overall timeout is done and that all threads have to exit */
+int stop = 0;
+
+unsigned long long critical_section_time_ns = 0;
+
+/* Same as cpuidle-smt-performance.c, with the old barrier loop elsewhere */
+#if defined(__PPC__)
+
+#define HMT_very_low()		asm volatile("or 31, 31, 31	# very low priority")
+#define HMT_low()		asm volatile("or 1, 1, 1	# low priority")
+#define HMT_medium()		asm volatile("or 2, 2, 2	# medium priority")
+
+#define cpu_relax()	do { HMT_very_low(); HMT_low(); HMT_medium(); barrier(); } while (0)
+#elif defined(__x86_64__)
+#define cpu_relax()    do {asm volatile("rep; nop" ::: "memory");} while (0)
+#else
 static inline void cpu_relax()
 {
 	int i;
 	for (i = 0; i < 10; i++)
 		barrier();
 }
+#endif
 
 /***********************************************************************
  * Timer Helpers
@@ -144,6 +182,212 @@ static unsigned long long compute_timediff(struct timespec before,
 	return 0;
 }
 
+#define NSECS_PER_SEC    (NSECS_PER_USEC * USECS_PER_SEC)
+
+/* Current time of clockid in nanoseconds */
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(clockid, &ts);
+	return ts.tv_sec * NSECS_PER_SEC + ts.tv_nsec;
+}
+
+/***********************************************************************
+ * Latency Histograms
+ *
+ * Log-linear histograms : Values below HIST_SUB ns get a bucket each.
+ * Above that, every power of two range is split into HIST_SUB linear
+ * buckets, so the relative error of a bucket is at most 1/HIST_SUB.
+ * Values of 2^HIST_MAX_BITS ns (~18 minutes) or more are clamped into
+ * the last bucket.
+ ***********************************************************************/
+#define HIST_SUB_BITS	4
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS	40
+#define HIST_BUCKETS	((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct lat_hist {
+	unsigned long long count;
+	unsigned long long sum_ns;
+	unsigned long long max_ns;
+	unsigned long long buckets[HIST_BUCKETS];
+};
+
+static int hist_bucket(unsigned long long ns)
+{
+	int msb, shift;
+
+	if (ns < HIST_SUB)
+		return ns;
+
+	msb = 63 - __builtin_clzll(ns);
+	if (msb >= HIST_MAX_BITS)
+		return HIST_BUCKETS - 1;
+
+	shift = msb - HIST_SUB_BITS;
+	return (shift + 1) * HIST_SUB + (ns >> shift) - HIST_SUB;
+}
+
+/* Largest value that falls in the given bucket */
+static unsigned long long hist_bucket_max(int bucket)
+{
+	int shift, sub;
+
+	if (bucket < HIST_SUB)
+		return bucket;
+
+	shift = bucket / HIST_SUB - 1;
+	sub = bucket % HIST_SUB;
+	return ((unsigned long long)(HIST_SUB + sub + 1) << shift) - 1;
+}
+
+static void hist_add(struct lat_hist *h, unsigned long long ns)
+{
+	h->count++;
+	h->sum_ns += ns;
+	if (ns > h->max_ns)
+		h->max_ns = ns;
+	h->buckets[hist_bucket(ns)]++;
+}
+
+static void hist_merge(struct lat_hist *dst, struct lat_hist *src)
+{
+	int i;
+
+	dst->count += src->count;
+	dst->sum_ns += src->sum_ns;
+	if (src->max_ns > dst->max_ns)
+		dst->max_ns = src->max_ns;
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+}
+
+/* Upper bound of the pct percentile value */
+static unsigned long long hist_percentile(struct lat_hist *h, double pct)
+{
+	unsigned long long target, seen = 0;
+	int i;
+
+	if (!h->count)
+		return 0;
+
+	target = (unsigned long long)(h->count * pct / 100);
+	if (target < 1)
+		target = 1;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= target)
+			break;
+	}
+
+	if (i == HIST_BUCKETS || hist_bucket_max(i) > h->max_ns)
+		return h->max_ns;
+
+	return hist_bucket_max(i);
+}
+
+static void print_hist(const char *prefix, struct lat_hist *h)
+{
+	printf("%s : p50 = %lld ns, p99 = %lld ns, p99.9 = %lld ns, max = %lld ns (%lld samples)\n",
+		prefix, hist_percentile(h, 50), hist_percentile(h, 99),
+		hist_percentile(h, 99.9), h->max_ns, h->count);
+}
+
+/***********************************************************************
+ * Topology Helpers
+ ***********************************************************************/
+#define MAX_CPUS	4096
+#define MAX_NODES	64
+
+const char *cpu_path = "/sys/devices/system/cpu/cpu%d";
+
+/* NUMA node of each CPU as found in sysfs. Defaults to node 0 */
+int cpu_node[MAX_CPUS];
+int nr_nodes = 1;
+
+/*
+ * The sysfs directory of a CPU contains a nodeN link to the NUMA node
+ * that the CPU belongs to.
+ */
+static void init_cpu_node_map(void)
+{
+	char path[100];
+	DIR *cpudir;
+	struct dirent *entry;
+	int cpu, node;
+
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		sprintf(path, cpu_path, cpu);
+		cpudir = opendir(path);
+		if (!cpudir)
+			continue;
+
+		while ((entry = readdir(cpudir))) {
+			if (sscanf(entry->d_name, "node%d", &node) != 1)
+				continue;
+			if (node < 0 || node >= MAX_NODES)
+				continue;
+			cpu_node[cpu] = node;
+			if (node + 1 > nr_nodes)
+				nr_nodes = node + 1;
+			break;
+		}
+		closedir(cpudir);
+	}
+}
+
+/*
+ * Core and package of each CPU, from the topology directory of the
+ * CPU. A core is identified by the first CPU of its
+ * thread_siblings_list, which, unlike core_id, is unique across
+ * packages.
+ */
+int cpu_core[MAX_CPUS];
+int cpu_package[MAX_CPUS];
+
+static int read_topology_int(int cpu, const char *file)
+{
+	char path[128];
+	FILE *fp;
+	int val;
+
+	sprintf(path, "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, file);
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	if (fscanf(fp, "%d", &val) != 1)
+		val = -1;
+	fclose(fp);
+
+	return val;
+}
+
+static void init_cpu_topology(void)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		cpu_core[cpu] = read_topology_int(cpu, "thread_siblings_list");
+		if (cpu_core[cpu] < 0)
+			cpu_core[cpu] = cpu;
+		cpu_package[cpu] = read_topology_int(cpu, "physical_package_id");
+		if (cpu_package[cpu] < 0)
+			cpu_package[cpu] = 0;
+	}
+}
+
+/* The NUMA node of the CPU that the caller is currently running on */
+static int current_node(void)
+{
+	int cpu = sched_getcpu();
+
+	if (cpu < 0 || cpu >= MAX_CPUS)
+		return 0;
+
+	return cpu_node[cpu];
+}
 
 /***********************************************************************
  * Futex primitives
@@ -154,51 +398,263 @@ static unsigned long long compute_timediff(struct timespec before,
 static int futex(int *uaddr, int futex_op, int val,
                  const struct timespec *timeout, int *uaddr2, int val3)
 {
-	return syscall(SYS_futex, uaddr, futex_op, val, timeout, uaddr, val3);
+	return syscall(SYS_futex, uaddr, futex_op, val, timeout, uaddr2, val3);
+}
+
+/*
+ * Contenders are forked processes instead of threads with --process.
+ *
+ * fwait/fpost pass FUTEX_PRIVATE_FLAG unless --futex-shared or
+ * --process is given. A shared futex is keyed on its backing page
+ * rather than on the mm, so every FUTEX_WAIT/FUTEX_WAKE has to look
+ * the page up, and all the shared futexes of the system hash into the
+ * same global futex hash table.
+ */
+int use_processes = 0;
+int futex_private = FUTEX_PRIVATE_FLAG;
+
+/*
+ * Zeroed memory that stays shared with the forked contenders, same as
+ * futex_setup() in context_switch2.c. The segment is removed as soon
+ * as the last process detaches from it.
+ */
+static void *shared_alloc(size_t size)
+{
+	int shmid;
+	void *shmaddr;
+
+	shmid = shmget(IPC_PRIVATE, size, SHM_R | SHM_W);
+	if (shmid < 0) {
+		perror("shmget");
+		exit(1);
+	}
+
+	shmaddr = shmat(shmid, NULL, 0);
+	if (shmaddr == (char *)-1) {
+		perror("shmat");
+		shmctl(shmid, IPC_RMID, NULL);
+		exit(1);
+	}
+
+	shmctl(shmid, IPC_RMID, NULL);
+
+	return shmaddr;
 }
 
 
+/*
+ * Slow-path counters of fwait/fpost. Each contending thread points
+ * my_futex_stats to its own cache line when --futex-stats is given, and
+ * leaves it NULL otherwise so that nothing is counted.
+ */
+struct futex_stats {
+	unsigned long long cas_attempts;
+	unsigned long long cas_failures;
+	unsigned long long wait_calls;
+	unsigned long long wait_eagain;
+	unsigned long long wake_calls;
+	unsigned long long wake_woken;
+	unsigned long long syscall_ns;
+} __cacheline_aligned;
+
+static struct futex_stats futex_stats[MAX_THREADS];
+static __thread struct futex_stats *my_futex_stats;
+
+/*
+ * What fwait() does between two of its -r userspace retries :
+ *
+ * none         : (default) Retry the CAS back to back.
+ * pause        : Test-and-test-and-set. Read the futex word and only
+ *                try the CAS when it is AVAILABLE, with a cpu_relax()
+ *                after every retry that failed.
+ * exponential  : Test-and-test-and-set with a delay of cpu_relax()
+ *                loops that doubles after every failed retry, up to
+ *                --backoff-max.
+ * proportional : Test-and-test-and-set with a delay of one cpu_relax()
+ *                per thread spinning in fwait(), up to --backoff-max.
+ *                The spinners are only counted within a process.
+ * yield        : Test-and-test-and-set with a sched_yield() after
+ *                every failed retry.
+ */
+#define BACKOFF_NONE		0
+#define BACKOFF_PAUSE		1
+#define BACKOFF_EXPONENTIAL	2
+#define BACKOFF_PROPORTIONAL	3
+#define BACKOFF_YIELD		4
+
+const char *backoff_names[] = {
+	[BACKOFF_NONE] = "none",
+	[BACKOFF_PAUSE] = "pause",
+	[BACKOFF_EXPONENTIAL] = "exponential",
+	[BACKOFF_PROPORTIONAL] = "proportional",
+	[BACKOFF_YIELD] = "yield",
+};
+
+int backoff = BACKOFF_NONE;
+unsigned long backoff_max = 1024;
+
+/* Run once per policy with --sweep-backoff */
+int backoff_sweep = 0;
+
+/* Threads in the userspace retry loop of fwait(), for proportional */
+static int fwait_spinners __cacheline_aligned;
+
+static void fwait_backoff(unsigned long *delay)
+{
+	unsigned long i, loops;
+
+	switch (backoff) {
+	case BACKOFF_PAUSE:
+		cpu_relax();
+		break;
+	case BACKOFF_EXPONENTIAL:
+		for (i = 0; i < *delay; i++)
+			cpu_relax();
+		if (*delay < backoff_max)
+			*delay *= 2;
+		break;
+	case BACKOFF_PROPORTIONAL:
+		loops = __atomic_load_n(&fwait_spinners, __ATOMIC_RELAXED);
+		if (loops > backoff_max)
+			loops = backoff_max;
+		for (i = 0; i < loops; i++)
+			cpu_relax();
+		break;
+	case BACKOFF_YIELD:
+		sched_yield();
+		break;
+	}
+}
+
 unsigned long fwait_retry_count = 1;
-static void fwait(int *futexp)
+/*
+ * Returns 0 once the lock is acquired, or ETIMEDOUT if deadline_ns
+ * (now_ns() time, 0 for none) passed before that.
+ */
+static int fwait_until(int *futexp, unsigned long long deadline_ns)
 {
 	int s;
 	unsigned long local_count = fwait_retry_count;
+	unsigned long delay;
+	struct futex_stats *fs = my_futex_stats;
+	unsigned long long syscall_start, now;
+	struct timespec ts, *tp = NULL;
 	
 	while (1) {
+		delay = 1;
+		if (backoff == BACKOFF_PROPORTIONAL)
+			__atomic_add_fetch(&fwait_spinners, 1, __ATOMIC_RELAXED);
 
 		/* Try for a few number of times in the userspace before making the kernel call */
 		while (local_count > 0) {
-			if (__sync_bool_compare_and_swap(futexp, AVAILABLE, BLOCKED))
-				return; /* We are the first to find it available. So we have control */
 			local_count--;
+
+			/* A large -r or backoff can spin past the deadline */
+			if (deadline_ns && now_ns() >= deadline_ns)
+				break;
+
+			if (backoff != BACKOFF_NONE &&
+			    *(volatile int *)futexp != AVAILABLE) {
+				fwait_backoff(&delay);
+				continue;
+			}
+
+			if (unlikely(fs != NULL))
+				fs->cas_attempts++;
+			if (__sync_bool_compare_and_swap(futexp, AVAILABLE, BLOCKED)) {
+				/* We are the first to find it available. So we have control */
+				if (backoff == BACKOFF_PROPORTIONAL)
+					__atomic_sub_fetch(&fwait_spinners, 1,
+							   __ATOMIC_RELAXED);
+				return 0;
+			}
+			if (unlikely(fs != NULL))
+				fs->cas_failures++;
+
+			if (backoff != BACKOFF_NONE)
+				fwait_backoff(&delay);
+		}
+
+		if (backoff == BACKOFF_PROPORTIONAL)
+			__atomic_sub_fetch(&fwait_spinners, 1, __ATOMIC_RELAXED);
+
+		if (deadline_ns) {
+			now = now_ns();
+			if (now >= deadline_ns)
+				return ETIMEDOUT;
+			ts.tv_sec = (deadline_ns - now) / NSECS_PER_SEC;
+			ts.tv_nsec = (deadline_ns - now) % NSECS_PER_SEC;
+			tp = &ts;
+		}
+
+		if (unlikely(fs != NULL)) {
+			fs->wait_calls++;
+			syscall_start = now_ns();
 		}
 
 		/* We wait for for someone to change the value of futexp from BLOCKED and wake us up */
-		s = futex(futexp, FUTEX_WAIT_PRIVATE, BLOCKED, NULL, NULL, 0);
-		if (s == -1 && errno != EAGAIN) {
+		s = futex(futexp, FUTEX_WAIT | futex_private, BLOCKED, tp,
+			  NULL, 0);
+		if (s == -1 && errno != EAGAIN && errno != ETIMEDOUT) {
 			printf("Error futex wait\n");
 			exit(1);
 		}
 
+		if (unlikely(fs != NULL)) {
+			if (s == -1 && errno == EAGAIN)
+				fs->wait_eagain++;
+			fs->syscall_ns += now_ns() - syscall_start;
+		}
+
+		if (s == -1 && errno == ETIMEDOUT)
+			return ETIMEDOUT;
+
 		/* Replenish the local count */
 		local_count = fwait_retry_count;
 	}
 }
 
+static void fwait(int *futexp)
+{
+	fwait_until(futexp, 0);
+}
+
 static void fpost(int *futexp, int nr_threads_to_wake)
 {
+	struct futex_stats *fs = my_futex_stats;
+	unsigned long long syscall_start;
+
 	if (__sync_bool_compare_and_swap(futexp, BLOCKED, AVAILABLE)) {
+		if (unlikely(fs != NULL))
+			syscall_start = now_ns();
+
 		/* We are the first to flip the value from BLOCKED to AVAILABLE. Wakeup the waiters */
-		int s = futex(futexp, FUTEX_WAKE_PRIVATE, nr_threads_to_wake,
-			      NULL, NULL, 0);
+		int s = futex(futexp, FUTEX_WAKE | futex_private,
+			      nr_threads_to_wake, NULL, NULL, 0);
 		if (s == -1) {
 			printf("Error futex wake\n");
 			exit(1);
 
 		}
+
+		if (unlikely(fs != NULL)) {
+			fs->syscall_ns += now_ns() - syscall_start;
+			fs->wake_calls++;
+			fs->wake_woken += s;
+		}
 	}
 }
 
+int print_futex_stats = 0;
+
+static void print_futex_stats_line(const char *prefix, struct futex_stats *fs)
+{
+	printf("%s : CAS = %lld (%lld failed), FUTEX_WAIT = %lld (%lld EAGAIN), FUTEX_WAKE = %lld (%lld woke a waiter), syscall time = %lld ns\n",
+		prefix, fs->cas_attempts, fs->cas_failures, fs->wait_calls,
+		fs->wait_eagain, fs->wake_calls, fs->wake_woken,
+		fs->syscall_ns);
+}
+
 /***********************************************************************
  * Mutex implementation
  ***********************************************************************/
@@ -214,6 +670,11 @@ static void mutex_lock(struct mutex *m)
 	fwait(&m->futexval);
 }
 
+static int mutex_lock_until(struct mutex *m, unsigned long long deadline_ns)
+{
+	return fwait_until(&m->futexval, deadline_ns);
+}
+
 static void mutex_unlock(struct mutex *m)
 {
 	fpost(&m->futexval, 1);
@@ -222,110 +683,3741 @@ static void mutex_unlock(struct mutex *m)
 DEFINE_MUTEX(thread_mutex);
 
 /***********************************************************************
- * Critical Section using Mutexes
+ * Lock algorithms
+ *
+ * The critical section is guarded by one of the following lock
+ * implementations selected with --lock. Each one provides an init
+ * routine, called once before the threads are created, and a
+ * lock/unlock pair that gets the id of the calling thread. Locks that
+ * support --deadline-us also provide lock_until, which gives up and
+ * returns non-zero once now_ns() reaches the deadline.
  ***********************************************************************/
-#define MAX_THREADS 2048
-int nr_threads = 4;
+struct lock_ops {
+	const char *name;
+	const char *desc;
+	void (*init)(void);
+	void (*lock)(int id);
+	int (*lock_until)(int id, unsigned long long deadline_ns);
+	void (*unlock)(int id);
+	void (*print_summary)(void);
+};
 
-unsigned long long critical_section_time_ns = 0;
-unsigned long long critical_section_entries = 0;
-unsigned long thread_entries[MAX_THREADS];
+/*
+ * fwait/fpost : Two-state futex mutex. Always wakes on unlock.
+ * With --process the mutex is moved to shared memory.
+ */
+static struct mutex *fwait_mutex = &thread_mutex;
 
-static void critical_section(int id)
+static void fwait_init(void)
 {
-	struct timespec start, end;
-	unsigned long long diff_ns;
+	if (!use_processes)
+		return;
 
-	mutex_lock(&thread_mutex);
-	clock_gettime(clockid, &start);
-	critical_section_entries++;
-	thread_entries[id]++;
+	fwait_mutex = shared_alloc(sizeof(*fwait_mutex));
+	fwait_mutex->futexval = AVAILABLE;
+}
 
-	do {
-		cpu_relax();
-		clock_gettime(clockid, &end);
-		diff_ns = compute_timediff(start, end);
-	} while(diff_ns < critical_section_time_ns);
+static void fwait_lock(int id)
+{
+	mutex_lock(fwait_mutex);
+}
 
-	mutex_unlock(&thread_mutex);
+static int fwait_lock_until(int id, unsigned long long deadline_ns)
+{
+	return mutex_lock_until(fwait_mutex, deadline_ns);
 }
 
+static void fwait_unlock(int id)
+{
+	mutex_unlock(fwait_mutex);
+}
 
-/* Global timeout : Default 10 seconds */
-unsigned long timeout = 10;
+/*
+ * Three-state futex mutex from Ulrich Drepper's "Futexes are Tricky"
+ * (same as mutex_lock/mutex_unlock in context_switch2.c).
+ * 0 : unlocked, 1 : locked with no waiters, 2 : locked with waiters.
+ * The unlocker skips FUTEX_WAKE when nobody is waiting.
+ */
+static int drepper_futexval;
 
-/* Global variable indicating that overall timeout is done and that all threads have to exit */
-int stop = 0;
+static int cmpxchg(int *p, int expected, int desired)
+{
+	int exp = expected;
 
-/* Signal handler to be called when the global timeout is done */
-static void sigalrm_handler(int junk)
+	__atomic_compare_exchange_n(p, &exp, desired, 0,
+				    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return exp;
+}
+
+static int xchg(int *p, int val)
 {
-	printf("Timeout complete. Stopping all threads\n");
-	stop = 1;
+	return __atomic_exchange_n(p, val, __ATOMIC_SEQ_CST);
 }
 
-/***********************************************************************
- * Contending Threads
- ***********************************************************************/
+static void drepper_init(void)
+{
+	drepper_futexval = 0;
+}
 
-static void *thread_fn(void *arg)
+static void drepper_lock(int id)
 {
-	int my_idx = *((int *)arg);
-	struct timespec cur;
-	clock_gettime(clockid, &cur);
-	debug_printf("[%lld.%lld] %d thread is active\n",
-		cur.tv_sec, cur.tv_nsec, my_idx);
+	int c;
 
-	debug_printf("critical section time = %lld ns\n", critical_section_time_ns);
-	if (my_idx == 0) {
-		/* Set an alarm for the global timeout */
-		signal(SIGALRM, sigalrm_handler);
-		alarm(timeout);
-	}
+	c = cmpxchg(&drepper_futexval, 0, 1);
+	if (!c)
+		return;
 
-	while (!stop)
-		critical_section(my_idx);
+	if (c == 1)
+		c = xchg(&drepper_futexval, 2);
 
-	clock_gettime(clockid, &cur);
-	debug_printf("[%lld.%lld] %d thread exiting...\n",
-		cur.tv_sec, cur.tv_nsec, my_idx);
-	
-	return NULL;
+	while (c) {
+		futex(&drepper_futexval, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+		c = xchg(&drepper_futexval, 2);
+	}
 }
 
-void print_usage(int argc, char *argv[])
+static void drepper_unlock(int id)
 {
-	printf("Usage: %s [OPTIONS]\n", argv[0]);
-	printf("Following options are available\n");
-	printf("-n, --nthreads\t\t\t Number of contending threads\n");
-	printf("-c, --crittime\t\t\t Time in ns spent inside critical section\n");
-	printf("-r, --retrycount\t\t The number of userspace retries before making futex syscall\n");
-	printf("-t, --timeout\t\t\t Time in seconds for program to run\n");
-	
-	printf("-h, --help\t\t\t Print this message\n");
+	if (xchg(&drepper_futexval, 0) == 1)
+		return;
+
+	futex(&drepper_futexval, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
 }
 
-void parse_args(int argc, char *argv[])
+/* glibc pthread_mutex in normal and adaptive (spin then sleep) modes */
+static pthread_mutex_t pthread_lock_mutex;
+
+static void pthread_mutex_init_type(int type)
 {
-	int c;
+	pthread_mutexattr_t attr;
 
-	int iteration_length_provided = 0;
-	int cache_size_provided = 0;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, type);
+	if (pthread_mutex_init(&pthread_lock_mutex, &attr)) {
+		printf("Error initializing pthread mutex\n");
+		exit(1);
+	}
+	pthread_mutexattr_destroy(&attr);
+}
 
-	while(1) {
-		static struct option long_options[] = {
-			{"nthreads", required_argument, 0, 'n'},
-			{"crittime", required_argument, 0, 'c'},
-			{"retrycount", required_argument, 0, 'r'},
-			{"timeout", required_argument, 0, 't'},
-			{"help", no_argument, 0, 'h'},
-			{0, 0, 0, 0},
-		};
+static void pthread_normal_init(void)
+{
+	pthread_mutex_init_type(PTHREAD_MUTEX_NORMAL);
+}
 
-		int option_index = 0;
-		int cpu;
+static void pthread_adaptive_init(void)
+{
+	pthread_mutex_init_type(PTHREAD_MUTEX_ADAPTIVE_NP);
+}
+
+static void pthread_lock(int id)
+{
+	pthread_mutex_lock(&pthread_lock_mutex);
+}
+
+static void pthread_unlock(int id)
+{
+	pthread_mutex_unlock(&pthread_lock_mutex);
+}
+
+/* glibc pthread_spinlock_t : Pure userspace spinning */
+static pthread_spinlock_t pthread_spin;
+
+static void spinlock_init(void)
+{
+	if (pthread_spin_init(&pthread_spin, PTHREAD_PROCESS_PRIVATE)) {
+		printf("Error initializing pthread spinlock\n");
+		exit(1);
+	}
+}
+
+static void spinlock_lock(int id)
+{
+	pthread_spin_lock(&pthread_spin);
+}
+
+static void spinlock_unlock(int id)
+{
+	pthread_spin_unlock(&pthread_spin);
+}
+
+/* Ticket lock : FIFO ordered spinning on a shared now-serving counter */
+struct ticket_lock {
+	unsigned int next;
+	unsigned int owner;
+};
+
+static struct ticket_lock ticket;
+
+static void ticket_acquire(struct ticket_lock *t)
+{
+	unsigned int my_ticket;
+
+	my_ticket = __atomic_fetch_add(&t->next, 1, __ATOMIC_ACQUIRE);
+	while (__atomic_load_n(&t->owner, __ATOMIC_ACQUIRE) != my_ticket)
+		cpu_relax();
+}
+
+static void ticket_release(struct ticket_lock *t)
+{
+	__atomic_store_n(&t->owner, t->owner + 1, __ATOMIC_RELEASE);
+}
+
+/* Called by the holder : Are there other threads queued behind us ? */
+static int ticket_has_waiters(struct ticket_lock *t)
+{
+	return __atomic_load_n(&t->next, __ATOMIC_RELAXED) - t->owner > 1;
+}
+
+static void ticket_init(void)
+{
+	ticket.next = 0;
+	ticket.owner = 0;
+}
+
+static void ticket_lock(int id)
+{
+	ticket_acquire(&ticket);
+}
+
+static void ticket_unlock(int id)
+{
+	ticket_release(&ticket);
+}
+
+/*
+ * Queue locks : Every waiter spins on a flag in its own cache line
+ * instead of all the contenders hammering a single lock word.
+ *
+ * The per-node flag is also a futex word. With the parking variants,
+ * a waiter that has spun fwait_retry_count times without being
+ * granted the lock marks its flag QNODE_PARKED and does a FUTEX_WAIT
+ * on it. The unlocker only makes the FUTEX_WAKE call if it finds the
+ * flag in the QNODE_PARKED state.
+ */
+#define QNODE_GRANTED	0
+#define QNODE_WAITING	1
+#define QNODE_PARKED	2
+
+static void qnode_wait(int *flag, int park)
+{
+	unsigned long spins = fwait_retry_count;
+
+	while (__atomic_load_n(flag, __ATOMIC_ACQUIRE) != QNODE_GRANTED) {
+		if (!park || spins > 0) {
+			spins--;
+			cpu_relax();
+			continue;
+		}
+
+		if (cmpxchg(flag, QNODE_WAITING, QNODE_PARKED) == QNODE_GRANTED)
+			break;
+
+		futex(flag, FUTEX_WAIT_PRIVATE, QNODE_PARKED, NULL, NULL, 0);
+	}
+}
+
+static void qnode_grant(int *flag)
+{
+	if (xchg(flag, QNODE_GRANTED) == QNODE_PARKED)
+		futex(flag, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* MCS lock : Waiters spin on their own node, which the predecessor flips */
+struct mcs_node {
+	struct mcs_node *next;
+	int locked;
+} __cacheline_aligned;
+
+static struct mcs_node mcs_nodes[MAX_THREADS];
+static struct mcs_node *mcs_tail __cacheline_aligned;
+
+static void mcs_init(void)
+{
+	mcs_tail = NULL;
+}
+
+static void __mcs_lock(int id, int park)
+{
+	struct mcs_node *node = &mcs_nodes[id];
+	struct mcs_node *prev;
+
+	node->next = NULL;
+	node->locked = QNODE_WAITING;
+
+	prev = __atomic_exchange_n(&mcs_tail, node, __ATOMIC_ACQ_REL);
+	if (!prev)
+		return;
+
+	__atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+	qnode_wait(&node->locked, park);
+}
+
+static void __mcs_unlock(int id)
+{
+	struct mcs_node *node = &mcs_nodes[id];
+	struct mcs_node *next;
+
+	next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+	if (!next) {
+		struct mcs_node *expected = node;
+
+		/* No known successor. Try to mark the queue empty */
+		if (__atomic_compare_exchange_n(&mcs_tail, &expected, NULL, 0,
+						__ATOMIC_RELEASE,
+						__ATOMIC_RELAXED))
+			return;
+
+		/* A successor is in the middle of linking itself in */
+		while (!(next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)))
+			cpu_relax();
+	}
+
+	qnode_grant(&next->locked);
+}
+
+static void mcs_lock(int id)
+{
+	__mcs_lock(id, 0);
+}
+
+static void mcs_park_lock(int id)
+{
+	__mcs_lock(id, 1);
+}
+
+static void mcs_unlock(int id)
+{
+	__mcs_unlock(id);
+}
+
+/*
+ * CLH lock : Waiters spin on the node of their predecessor. On
+ * unlock, the thread adopts the node of its predecessor for its next
+ * acquisition, so there is one more node than there are threads.
+ */
+struct clh_node {
+	int locked;
+} __cacheline_aligned;
+
+static struct clh_node clh_nodes[MAX_THREADS + 1];
+static struct clh_node *clh_tail __cacheline_aligned;
+static struct clh_node *clh_my_node[MAX_THREADS];
+static struct clh_node *clh_my_pred[MAX_THREADS];
+
+static void clh_init(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_THREADS; i++)
+		clh_my_node[i] = &clh_nodes[i];
+
+	clh_nodes[MAX_THREADS].locked = QNODE_GRANTED;
+	clh_tail = &clh_nodes[MAX_THREADS];
+}
+
+static void __clh_lock(int id, int park)
+{
+	struct clh_node *node = clh_my_node[id];
+	struct clh_node *pred;
+
+	node->locked = QNODE_WAITING;
+	pred = __atomic_exchange_n(&clh_tail, node, __ATOMIC_ACQ_REL);
+	clh_my_pred[id] = pred;
+	qnode_wait(&pred->locked, park);
+}
+
+static void clh_lock(int id)
+{
+	__clh_lock(id, 0);
+}
+
+static void clh_park_lock(int id)
+{
+	__clh_lock(id, 1);
+}
+
+static void clh_unlock(int id)
+{
+	struct clh_node *node = clh_my_node[id];
+
+	clh_my_node[id] = clh_my_pred[id];
+	qnode_grant(&node->locked);
+}
+
+/*
+ * Cohort lock (Dice, Marathe, Shavit) : A ticket lock per NUMA node
+ * plus a global ticket lock. The first thread of a node to get its
+ * local lock acquires the global lock on behalf of the node. On
+ * unlock, if other threads of the same node are queued on the local
+ * lock, the global lock is passed along with the local lock, at most
+ * cohort_limit times in a row, before it is released to other nodes.
+ *
+ * The node of a thread is refreshed in thread_node[] before every
+ * acquisition.
+ */
+int thread_node[MAX_THREADS];
+unsigned long cohort_limit = 64;
+
+struct cohort_node {
+	struct ticket_lock local;
+	int global_held;
+	unsigned long handoffs;
+} __cacheline_aligned;
+
+static struct cohort_node cohort_nodes[MAX_NODES];
+static struct ticket_lock cohort_global __cacheline_aligned;
+
+static void cohort_init(void)
+{
+	memset(cohort_nodes, 0, sizeof(cohort_nodes));
+	memset(&cohort_global, 0, sizeof(cohort_global));
+}
+
+static void cohort_lock(int id)
+{
+	struct cohort_node *n = &cohort_nodes[thread_node[id]];
+
+	ticket_acquire(&n->local);
+	if (!n->global_held) {
+		ticket_acquire(&cohort_global);
+		n->global_held = 1;
+		n->handoffs = 0;
+	}
+}
+
+static void print_cohort_summary(void)
+{
+	printf("Cohort limit = %lu\n", cohort_limit);
+}
+
+static void cohort_unlock(int id)
+{
+	struct cohort_node *n = &cohort_nodes[thread_node[id]];
+
+	if (n->handoffs < cohort_limit && ticket_has_waiters(&n->local)) {
+		/* Pass the global lock to the next thread on this node */
+		n->handoffs++;
+		ticket_release(&n->local);
+		return;
+	}
+
+	n->global_held = 0;
+	ticket_release(&cohort_global);
+	ticket_release(&n->local);
+}
+
+/*
+ * Priority inheritance futex lock. The futex word holds the TID of the
+ * owner. The uncontended paths are a CAS in userspace, otherwise the
+ * kernel queues the waiters and boosts the owner to the priority of
+ * the highest priority waiter.
+ */
+int thread_kernel_tid[MAX_THREADS];
+static int pi_futexval;
+
+static void pi_init(void)
+{
+	pi_futexval = 0;
+}
+
+static void pi_lock(int id)
+{
+	if (!cmpxchg(&pi_futexval, 0, thread_kernel_tid[id]))
+		return;
+
+	while (futex(&pi_futexval, FUTEX_LOCK_PI_PRIVATE, 0, NULL, NULL, 0)) {
+		if (errno == EINTR || errno == EAGAIN)
+			continue;
+		perror("futex lock pi");
+		exit(1);
+	}
+}
+
+static void pi_unlock(int id)
+{
+	int tid = thread_kernel_tid[id];
+
+	if (cmpxchg(&pi_futexval, tid, 0) == tid)
+		return;
+
+	if (futex(&pi_futexval, FUTEX_UNLOCK_PI_PRIVATE, 0, NULL, NULL, 0)) {
+		perror("futex unlock pi");
+		exit(1);
+	}
+}
+
+static void pthread_pi_init(void)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	if (pthread_mutex_init(&pthread_lock_mutex, &attr)) {
+		printf("Error initializing pthread PI mutex\n");
+		exit(1);
+	}
+	pthread_mutexattr_destroy(&attr);
+}
+
+/*
+ * Adaptive fwait : Same as fwait/fpost, but the number of CAS retries
+ * before the FUTEX_WAIT is tuned at runtime instead of being fixed by
+ * -r, which only provides the starting value.
+ *
+ * Spinning is worth it as long as it costs less than blocking. A
+ * waiter is expected to wait for at most about one hold time of the
+ * current owner, while blocking costs the wake-to-run latency of a
+ * FUTEX_WAKE. So the spin budget is min(2 * hold time, wake latency),
+ * which is the classic 2-competitive spin-then-block policy. It is
+ * converted to a number of CAS retries using the observed cost of a
+ * retry.
+ *
+ * All three are tracked as EWMAs that are only updated by the lock
+ * holder, so they need no atomics. Waiters read the current budget
+ * without holding the lock.
+ */
+#define ADAPTIVE_MAX_SPINS	1000000UL
+#define ADAPTIVE_EWMA_SHIFT	3
+#define ADAPTIVE_LOG_NS		NSECS_PER_SEC
+#define MAX_ADAPTIVE_SAMPLES	4096
+
+struct adaptive_sample {
+	unsigned long long ts_ns;
+	unsigned long spin_budget;
+	unsigned long long hold_ns;
+	unsigned long long wake_ns;
+};
+
+struct adaptive_lock {
+	int futexval __cacheline_aligned;
+	unsigned long spin_budget __cacheline_aligned;
+	long long hold_ewma_ns;
+	long long wake_ewma_ns;
+	long long retry_ewma_ps;
+	unsigned long long acquired_ns;
+	unsigned long long unlock_ns;
+	unsigned long long start_ns;
+	unsigned long long next_log_ns;
+	int nr_samples;
+	struct adaptive_sample samples[MAX_ADAPTIVE_SAMPLES];
+};
+
+static struct adaptive_lock adaptive;
+
+static void ewma_update(long long *ewma, long long sample)
+{
+	*ewma += (sample - *ewma) >> ADAPTIVE_EWMA_SHIFT;
+}
+
+static void adaptive_init(void)
+{
+	adaptive.futexval = AVAILABLE;
+	adaptive.spin_budget = fwait_retry_count;
+	adaptive.hold_ewma_ns = critical_section_time_ns;
+	adaptive.wake_ewma_ns = 5 * NSECS_PER_USEC;
+	adaptive.retry_ewma_ps = 10000;
+	adaptive.start_ns = now_ns();
+	adaptive.next_log_ns = adaptive.start_ns;
+}
+
+static void adaptive_lock(int id)
+{
+	unsigned long local_count = __atomic_load_n(&adaptive.spin_budget,
+						    __ATOMIC_RELAXED);
+	unsigned long long start_ns = now_ns(), slept_ns = 0, wake_ns = 0;
+	unsigned long long t0, t1;
+	unsigned long retries = 0;
+	int s;
+
+	while (1) {
+		while (local_count > 0) {
+			if (__sync_bool_compare_and_swap(&adaptive.futexval,
+							 AVAILABLE, BLOCKED))
+				goto acquired;
+			retries++;
+			local_count--;
+		}
+
+		t0 = now_ns();
+		s = futex(&adaptive.futexval, FUTEX_WAIT_PRIVATE, BLOCKED,
+			  NULL, NULL, 0);
+		if (s == -1 && errno != EAGAIN) {
+			printf("Error futex wait\n");
+			exit(1);
+		}
+		t1 = now_ns();
+		slept_ns += t1 - t0;
+
+		/* Woken up by fpost : How long did it take us to run ? */
+		if (!s && adaptive.unlock_ns > t0)
+			wake_ns = t1 - adaptive.unlock_ns;
+
+		local_count = __atomic_load_n(&adaptive.spin_budget,
+					      __ATOMIC_RELAXED);
+	}
+
+acquired:
+	adaptive.acquired_ns = now_ns();
+
+	if (retries) {
+		unsigned long long spun_ns;
+
+		spun_ns = adaptive.acquired_ns - start_ns - slept_ns;
+		ewma_update(&adaptive.retry_ewma_ps, spun_ns * 1000 / retries);
+	}
+
+	if (wake_ns)
+		ewma_update(&adaptive.wake_ewma_ns, wake_ns);
+}
+
+static void adaptive_unlock(int id)
+{
+	unsigned long long now = now_ns();
+	unsigned long long budget_ns;
+	unsigned long budget;
+
+	ewma_update(&adaptive.hold_ewma_ns, now - adaptive.acquired_ns);
+
+	budget_ns = 2 * adaptive.hold_ewma_ns;
+	if (adaptive.wake_ewma_ns < budget_ns)
+		budget_ns = adaptive.wake_ewma_ns;
+
+	budget = budget_ns * 1000 / (adaptive.retry_ewma_ps ? : 1);
+	if (budget < 1)
+		budget = 1;
+	if (budget > ADAPTIVE_MAX_SPINS)
+		budget = ADAPTIVE_MAX_SPINS;
+	__atomic_store_n(&adaptive.spin_budget, budget, __ATOMIC_RELAXED);
+
+	if (now >= adaptive.next_log_ns &&
+	    adaptive.nr_samples < MAX_ADAPTIVE_SAMPLES) {
+		struct adaptive_sample *as;
+
+		as = &adaptive.samples[adaptive.nr_samples++];
+		as->ts_ns = now - adaptive.start_ns;
+		as->spin_budget = budget;
+		as->hold_ns = adaptive.hold_ewma_ns;
+		as->wake_ns = adaptive.wake_ewma_ns;
+		adaptive.next_log_ns = now + ADAPTIVE_LOG_NS;
+	}
+
+	adaptive.unlock_ns = now_ns();
+	fpost(&adaptive.futexval, 1);
+}
+
+static void print_adaptive_summary(void)
+{
+	int i;
+
+	for (i = 0; i < adaptive.nr_samples; i++) {
+		struct adaptive_sample *as = &adaptive.samples[i];
+
+		printf("[%6.3f s] spin budget = %lu (hold = %lld ns, wake = %lld ns)\n",
+			(double) as->ts_ns / NSECS_PER_SEC, as->spin_budget,
+			as->hold_ns, as->wake_ns);
+	}
+
+	printf("Final spin budget = %lu retries (hold = %lld ns, wake = %lld ns, retry = %lld ps)\n",
+		adaptive.spin_budget, adaptive.hold_ewma_ns,
+		adaptive.wake_ewma_ns, adaptive.retry_ewma_ps);
+}
+
+/*
+ * Handoff fwait : fwait/fpost with an explicit ownership policy on
+ * unlock. Waiters queue in FIFO order on per-ticket futex slots and
+ * only the oldest waiter (the head) competes for the lock word. When
+ * unlocking with waiters queued, the holder either
+ *  - hands off : leaves the word BLOCKED and grants the head's slot,
+ *    so the head already owns the lock when it runs, or
+ *  - releases : sets the word AVAILABLE and kicks the head, which then
+ *    races with the arriving threads spinning on the word (barging).
+ *
+ * fwait-fifo always hands off and arriving threads queue instead of
+ * spinning on the word, so the lock is granted in strict FIFO order.
+ * fwait-bounded releases until the head has been kicked --barge-limit
+ * times without getting the lock, then hands off to it.
+ *
+ * The wake-to-run gap is the time from the unlock that granted or
+ * kicked the head till the head owns the lock. With a direct handoff
+ * nobody can run the critical section during that time.
+ */
+struct handoff_slot {
+	int flag __cacheline_aligned;
+	int handoff;
+};
+
+struct handoff_lock {
+	int futexval __cacheline_aligned;
+	unsigned int tail __cacheline_aligned;
+	unsigned int head __cacheline_aligned;
+	/* Protected by the lock itself */
+	unsigned long bypassed;
+	unsigned long long signal_ns;
+	unsigned long long handoffs;
+	unsigned long long releases;
+	unsigned long long barges;
+	unsigned long long head_wins;
+	struct lat_hist gap_hist;
+	struct handoff_slot slots[MAX_THREADS];
+};
+
+static struct handoff_lock handoff;
+static int handoff_fifo;
+unsigned long barge_limit = 8;
+
+static void handoff_init(void)
+{
+	int i;
+
+	memset(&handoff, 0, sizeof(handoff));
+	handoff.futexval = AVAILABLE;
+	for (i = 0; i < MAX_THREADS; i++)
+		handoff.slots[i].flag = QNODE_WAITING;
+}
+
+static void handoff_fifo_init(void)
+{
+	handoff_fifo = 1;
+	handoff_init();
+}
+
+static void handoff_bounded_init(void)
+{
+	handoff_fifo = 0;
+	handoff_init();
+}
+
+static int handoff_queued(void)
+{
+	return __atomic_load_n(&handoff.head, __ATOMIC_SEQ_CST) !=
+		__atomic_load_n(&handoff.tail, __ATOMIC_SEQ_CST);
+}
+
+static void handoff_lock(int id)
+{
+	unsigned long local_count = handoff_fifo ? 0 : fwait_retry_count;
+	struct handoff_slot *s;
+	unsigned int t;
+
+	while (local_count > 0) {
+		if (cmpxchg(&handoff.futexval, AVAILABLE, BLOCKED) == AVAILABLE) {
+			if (handoff_queued())
+				handoff.barges++;
+			return;
+		}
+		local_count--;
+	}
+
+	t = __atomic_fetch_add(&handoff.tail, 1, __ATOMIC_SEQ_CST);
+	s = &handoff.slots[t % MAX_THREADS];
+
+	/*
+	 * Stale kicks are possible, so only act as the head and always
+	 * rearm the slot before checking the lock again.
+	 */
+	while (1) {
+		if (__atomic_load_n(&handoff.head, __ATOMIC_ACQUIRE) == t) {
+			if (s->handoff) {
+				s->handoff = 0;
+				break;
+			}
+			if (cmpxchg(&handoff.futexval, AVAILABLE, BLOCKED) == AVAILABLE) {
+				handoff.head_wins++;
+				break;
+			}
+		}
+
+		qnode_wait(&s->flag, 1);
+		__atomic_store_n(&s->flag, QNODE_WAITING, __ATOMIC_SEQ_CST);
+	}
+
+	if (handoff.signal_ns) {
+		hist_add(&handoff.gap_hist, now_ns() - handoff.signal_ns);
+		handoff.signal_ns = 0;
+	}
+	handoff.bypassed = 0;
+	__atomic_store_n(&handoff.head, t + 1, __ATOMIC_RELEASE);
+}
+
+static void handoff_unlock(int id)
+{
+	unsigned int head = handoff.head;
+	struct handoff_slot *s = &handoff.slots[head % MAX_THREADS];
+
+	if (!handoff_queued()) {
+		__atomic_store_n(&handoff.futexval, AVAILABLE, __ATOMIC_SEQ_CST);
+
+		/* Raced with a thread that queued before seeing the release */
+		if (handoff_queued())
+			qnode_grant(&s->flag);
+		return;
+	}
+
+	handoff.signal_ns = now_ns();
+
+	if (handoff_fifo || handoff.bypassed >= barge_limit) {
+		handoff.handoffs++;
+		s->handoff = 1;
+		qnode_grant(&s->flag);
+		return;
+	}
+
+	handoff.releases++;
+	handoff.bypassed++;
+	__atomic_store_n(&handoff.futexval, AVAILABLE, __ATOMIC_SEQ_CST);
+	qnode_grant(&s->flag);
+}
+
+static void print_handoff_summary(void)
+{
+	if (handoff_fifo)
+		printf("Ownership policy = FIFO handoff\n");
+	else
+		printf("Ownership policy = bounded barging (barge limit = %lu)\n",
+			barge_limit);
+
+	printf("Direct handoffs = %lld, releases to barging = %lld, barges past waiters = %lld, head wins after release = %lld\n",
+		handoff.handoffs, handoff.releases, handoff.barges,
+		handoff.head_wins);
+	print_hist("Wake-to-run gap", &handoff.gap_hist);
+}
+
+static struct lock_ops lock_table[] = {
+	{
+		.name = "fwait",
+		.desc = "Two-state futex mutex (fwait/fpost)",
+		.init = fwait_init,
+		.lock = fwait_lock,
+		.lock_until = fwait_lock_until,
+		.unlock = fwait_unlock,
+	},
+	{
+		.name = "fwait-adaptive",
+		.desc = "fwait/fpost with the -r retry count tuned at runtime",
+		.init = adaptive_init,
+		.lock = adaptive_lock,
+		.unlock = adaptive_unlock,
+		.print_summary = print_adaptive_summary,
+	},
+	{
+		.name = "fwait-fifo",
+		.desc = "fwait/fpost, unlock hands off to the oldest waiter",
+		.init = handoff_fifo_init,
+		.lock = handoff_lock,
+		.unlock = handoff_unlock,
+		.print_summary = print_handoff_summary,
+	},
+	{
+		.name = "fwait-bounded",
+		.desc = "fwait/fpost, barging until a waiter lost --barge-limit times",
+		.init = handoff_bounded_init,
+		.lock = handoff_lock,
+		.unlock = handoff_unlock,
+		.print_summary = print_handoff_summary,
+	},
+	{
+		.name = "drepper",
+		.desc = "Three-state futex mutex, skips wake when uncontended",
+		.init = drepper_init,
+		.lock = drepper_lock,
+		.unlock = drepper_unlock,
+	},
+	{
+		.name = "pthread",
+		.desc = "glibc pthread_mutex (PTHREAD_MUTEX_NORMAL)",
+		.init = pthread_normal_init,
+		.lock = pthread_lock,
+		.unlock = pthread_unlock,
+	},
+	{
+		.name = "pthread-adaptive",
+		.desc = "glibc pthread_mutex (PTHREAD_MUTEX_ADAPTIVE_NP)",
+		.init = pthread_adaptive_init,
+		.lock = pthread_lock,
+		.unlock = pthread_unlock,
+	},
+	{
+		.name = "spinlock",
+		.desc = "glibc pthread_spinlock_t",
+		.init = spinlock_init,
+		.lock = spinlock_lock,
+		.unlock = spinlock_unlock,
+	},
+	{
+		.name = "ticket",
+		.desc = "FIFO ticket spinlock",
+		.init = ticket_init,
+		.lock = ticket_lock,
+		.unlock = ticket_unlock,
+	},
+	{
+		.name = "mcs",
+		.desc = "MCS queue lock, spins on own node",
+		.init = mcs_init,
+		.lock = mcs_lock,
+		.unlock = mcs_unlock,
+	},
+	{
+		.name = "mcs-park",
+		.desc = "MCS queue lock, FUTEX_WAIT on own node after -r spins",
+		.init = mcs_init,
+		.lock = mcs_park_lock,
+		.unlock = mcs_unlock,
+	},
+	{
+		.name = "clh",
+		.desc = "CLH queue lock, spins on predecessor's node",
+		.init = clh_init,
+		.lock = clh_lock,
+		.unlock = clh_unlock,
+	},
+	{
+		.name = "clh-park",
+		.desc = "CLH queue lock, FUTEX_WAIT on the node after -r spins",
+		.init = clh_init,
+		.lock = clh_park_lock,
+		.unlock = clh_unlock,
+	},
+	{
+		.name = "cohort",
+		.desc = "NUMA cohort lock, per-node + global ticket locks",
+		.init = cohort_init,
+		.lock = cohort_lock,
+		.unlock = cohort_unlock,
+		.print_summary = print_cohort_summary,
+	},
+	{
+		.name = "pi",
+		.desc = "Priority inheritance futex (FUTEX_LOCK_PI/UNLOCK_PI)",
+		.init = pi_init,
+		.lock = pi_lock,
+		.unlock = pi_unlock,
+	},
+	{
+		.name = "pthread-pi",
+		.desc = "glibc pthread_mutex (PTHREAD_PRIO_INHERIT)",
+		.init = pthread_pi_init,
+		.lock = pthread_lock,
+		.unlock = pthread_unlock,
+	},
+};
+
+#define NR_LOCK_TYPES	(sizeof(lock_table) / sizeof(lock_table[0]))
+
+/* The lock implementation in use. Defaults to fwait/fpost */
+struct lock_ops *lock_ops = &lock_table[0];
+
+static struct lock_ops *find_lock_ops(const char *name)
+{
+	int i;
+
+	for (i = 0; i < NR_LOCK_TYPES; i++) {
+		if (!strcmp(lock_table[i].name, name))
+			return &lock_table[i];
+	}
+
+	return NULL;
+}
+
+/***********************************************************************
+ * Critical Section using Mutexes
+ ***********************************************************************/
+unsigned long long critical_section_entries = 0;
+unsigned long thread_entries[MAX_THREADS];
+
+/* Locality of the lock handoffs. Protected by the lock itself */
+unsigned long long node_entries[MAX_NODES];
+unsigned long long cross_node_handoffs = 0;
+int last_holder_node = -1;
+
+/*
+ * Spinning for a given time inside the critical section.
+ *
+ * clock      : Read the clock after every cpu_relax() till the time is
+ *              up. With short critical sections the length ends up
+ *              being dominated by the cost of the clock reads.
+ * calibrated : Run a fixed number of cpu_relax() loops, computed from
+ *              the loops per ns measured by calibrate_spin() at startup.
+ *
+ * Every HOLD_SAMPLE_INTERVAL entries, the time actually spent spinning
+ * is measured so that it can be compared with the requested time.
+ */
+#define SPIN_CLOCK		0
+#define SPIN_CALIBRATED		1
+
+#define CALIBRATE_LOOPS		1000000ULL
+#define CALIBRATE_ROUNDS	10
+#define HOLD_SAMPLE_INTERVAL	64
+
+int spin_mode = SPIN_CALIBRATED;
+double spin_loops_per_ns = 1;
+
+/* Cost of the pair of clock reads around a sampled hold */
+unsigned long long clock_overhead_ns = 0;
+
+unsigned long long hold_samples = 0;
+unsigned long long hold_sampled_ns = 0;
+struct lat_hist hold_hist;
+
+static void spin_loops(unsigned long long loops)
+{
+	while (loops--)
+		cpu_relax();
+}
+
+/* Fastest of a few rounds, so that interrupts and preemption don't count */
+static void calibrate_spin(void)
+{
+	unsigned long long best_ns = ULLONG_MAX, t0, t1;
+	int i;
+
+	for (i = 0; i < CALIBRATE_ROUNDS; i++) {
+		t0 = now_ns();
+		spin_loops(CALIBRATE_LOOPS);
+		t1 = now_ns();
+		if (t1 - t0 < best_ns)
+			best_ns = t1 - t0;
+	}
+
+	spin_loops_per_ns = (double) CALIBRATE_LOOPS / (best_ns ? : 1);
+
+	clock_overhead_ns = ULLONG_MAX;
+	for (i = 0; i < CALIBRATE_ROUNDS * 100; i++) {
+		t0 = now_ns();
+		t1 = now_ns();
+		if (t1 - t0 < clock_overhead_ns)
+			clock_overhead_ns = t1 - t0;
+	}
+}
+
+static void spin_ns(unsigned long long ns);
+
+/*
+ * Time taken by the -c spin with nothing running alongside, measured
+ * by the main thread before the contenders start. The sampled holds of
+ * the run are compared against it, so that any slowdown of the holder,
+ * eg by spinning waiters on its SMT siblings, shows as an inflation of
+ * the hold. With the calibrated spin the work done in a hold is fixed,
+ * so the inflation is that of the time needed to complete it. This
+ * costs 10 ms plus 1000 holds, so it is only done with
+ * --hold-inflation or --sweep-backoff, and with the calibrated spin
+ * only since the clock spin makes the hold time fixed.
+ */
+int hold_inflation = 0;
+unsigned long long isolated_hold_ns = 0;
+
+static void measure_isolated_hold(void)
+{
+	struct lat_hist *h;
+	unsigned long long t0, held_ns;
+	int i;
+
+	h = calloc(1, sizeof(*h));
+	if (!h) {
+		perror("calloc");
+		exit(1);
+	}
+
+	/* Warm up first, the clock and caches may still be cold */
+	spin_ns(10 * NSECS_PER_MSEC);
+
+	for (i = 0; i < CALIBRATE_ROUNDS * 100; i++) {
+		t0 = now_ns();
+		spin_ns(critical_section_time_ns);
+		held_ns = now_ns() - t0;
+		if (held_ns > clock_overhead_ns)
+			held_ns -= clock_overhead_ns;
+		hist_add(h, held_ns);
+	}
+
+	isolated_hold_ns = hist_percentile(h, 50);
+	free(h);
+}
+
+/* Spin for the given number of ns */
+static void spin_ns(unsigned long long ns)
+{
+	struct timespec start, end;
+	unsigned long long diff_ns;
+
+	if (spin_mode == SPIN_CALIBRATED) {
+		spin_loops(ns * spin_loops_per_ns);
+		return;
+	}
+
+	clock_gettime(clockid, &start);
+	do {
+		cpu_relax();
+		clock_gettime(clockid, &end);
+		diff_ns = compute_timediff(start, end);
+	} while(diff_ns < ns);
+}
+
+/*
+ * Random distributions for the think time and the critical section
+ * length : fixed:<ns>, exp:<mean ns> or bimodal:<ns1>:<ns2>:<pct of ns1>.
+ */
+#define DIST_NONE	0
+#define DIST_FIXED	1
+#define DIST_EXP	2
+#define DIST_BIMODAL	3
+
+struct dist {
+	int type;
+	unsigned long long a;
+	unsigned long long b;
+	unsigned int pct;
+};
+
+static void parse_dist(char *arg, struct dist *d)
+{
+	memset(d, 0, sizeof(*d));
+
+	if (sscanf(arg, "fixed:%llu", &d->a) == 1) {
+		d->type = DIST_FIXED;
+	} else if (sscanf(arg, "exp:%llu", &d->a) == 1) {
+		d->type = DIST_EXP;
+	} else if (sscanf(arg, "bimodal:%llu:%llu:%u", &d->a, &d->b,
+			  &d->pct) == 3 && d->pct <= 100) {
+		d->type = DIST_BIMODAL;
+	} else {
+		printf("Invalid distribution %s\n", arg);
+		exit(1);
+	}
+}
+
+/* Uniform in (0, 1) */
+static double rand_unit(unsigned int *seed)
+{
+	return (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+}
+
+static unsigned long long dist_sample(struct dist *d, unsigned int *seed)
+{
+	switch (d->type) {
+	case DIST_FIXED:
+		return d->a;
+	case DIST_EXP:
+		return -log(rand_unit(seed)) * d->a;
+	case DIST_BIMODAL:
+		return (rand_r(seed) % 100 < d->pct) ? d->a : d->b;
+	}
+
+	return 0;
+}
+
+static double dist_mean(struct dist *d)
+{
+	if (d->type == DIST_BIMODAL)
+		return (d->a * d->pct + d->b * (100.0 - d->pct)) / 100;
+
+	return d->a;
+}
+
+static void dist_desc(struct dist *d, char *buf)
+{
+	switch (d->type) {
+	case DIST_FIXED:
+		sprintf(buf, "fixed %lld ns", d->a);
+		break;
+	case DIST_EXP:
+		sprintf(buf, "exponential, mean %lld ns", d->a);
+		break;
+	case DIST_BIMODAL:
+		sprintf(buf, "bimodal, %lld ns (%u%%) / %lld ns", d->a,
+			d->pct, d->b);
+		break;
+	default:
+		sprintf(buf, "none");
+	}
+}
+
+/*
+ * With --crit-dist, the length of every critical section is drawn from
+ * the distribution instead of being -c. The seed is per thread, since
+ * the striped, multi-lock and barrier modes run critical sections
+ * concurrently.
+ */
+struct dist crit_dist;
+static __thread unsigned int crit_seed = 1;
+
+static unsigned long long crit_time_ns(void)
+{
+	if (crit_dist.type == DIST_NONE)
+		return critical_section_time_ns;
+
+	return dist_sample(&crit_dist, &crit_seed);
+}
+
+/*
+ * Lock protected shared data. With --cs-lines=N, every critical section
+ * touches N cache lines of cs_data : the first cs_write_pct % of them
+ * are incremented and the rest are only read. The time spent touching
+ * them is sampled like the hold time, and compared with the time the
+ * same touches take when the lines are already in the local cache, to
+ * estimate the cost of the lines migrating between the holders.
+ */
+#define MAX_CS_LINES	65536
+
+struct cs_line {
+	unsigned long val;
+} __cacheline_aligned;
+
+static struct cs_line *cs_data;
+unsigned long cs_lines = 0;
+unsigned int cs_write_pct = 100;
+unsigned long cs_write_lines;
+
+unsigned long long cs_hot_touch_ns = 0;
+unsigned long long cs_touch_samples = 0;
+unsigned long long cs_touch_sampled_ns = 0;
+
+static void cs_touch_lines(unsigned long nr_write)
+{
+	unsigned long sum = 0;
+	unsigned long i;
+
+	for (i = 0; i < nr_write; i++)
+		cs_data[i].val++;
+
+	for (; i < cs_lines; i++)
+		sum += cs_data[i].val;
+
+	asm volatile("# %0" : : "r"(sum));
+}
+
+/* Time to touch the lines when they are hot in our cache */
+static void init_cs_data(void)
+{
+	unsigned long long best_ns = ULLONG_MAX, t0, t1;
+	int i;
+
+	if (!cs_lines)
+		return;
+
+	if (use_processes)
+		cs_data = shared_alloc(cs_lines * sizeof(*cs_data));
+	else
+		cs_data = aligned_alloc(CACHELINE_SIZE,
+					cs_lines * sizeof(*cs_data));
+	if (!cs_data) {
+		perror("aligned_alloc");
+		exit(1);
+	}
+	memset(cs_data, 0, cs_lines * sizeof(*cs_data));
+
+	cs_write_lines = cs_lines * cs_write_pct / 100;
+
+	for (i = 0; i < CALIBRATE_ROUNDS * 10; i++) {
+		t0 = now_ns();
+		cs_touch_lines(cs_write_lines);
+		t1 = now_ns() - clock_overhead_ns;
+		if (t1 > t0 && t1 - t0 < best_ns)
+			best_ns = t1 - t0;
+	}
+	cs_hot_touch_ns = (best_ns == ULLONG_MAX) ? 0 : best_ns;
+}
+
+static void print_cs_data_summary(void)
+{
+	unsigned long long touch_ns;
+
+	if (!cs_lines)
+		return;
+
+	touch_ns = cs_touch_samples ? cs_touch_sampled_ns / cs_touch_samples : 0;
+	printf("Shared data = %lu lines (%lu written), touch time = %lld ns/entry, cache-hot = %lld ns, migration cost = %lld ns/entry\n",
+		cs_lines, cs_write_lines, touch_ns, cs_hot_touch_ns,
+		touch_ns > cs_hot_touch_ns ? touch_ns - cs_hot_touch_ns : 0);
+}
+
+/*
+ * The work done on behalf of thread id while the lock is held. node is
+ * the NUMA node of the thread that is executing it.
+ */
+static void critical_section_body(int id, int node)
+{
+	critical_section_entries++;
+	thread_entries[id]++;
+
+	node_entries[node]++;
+	if (last_holder_node != -1 && last_holder_node != node)
+		cross_node_handoffs++;
+	last_holder_node = node;
+
+	if (cs_lines) {
+		if (critical_section_entries % HOLD_SAMPLE_INTERVAL == 0) {
+			unsigned long long t0 = now_ns(), touch_ns;
+
+			cs_touch_lines(cs_write_lines);
+			touch_ns = now_ns() - t0;
+			if (touch_ns > clock_overhead_ns)
+				touch_ns -= clock_overhead_ns;
+			cs_touch_sampled_ns += touch_ns;
+			cs_touch_samples++;
+		} else {
+			cs_touch_lines(cs_write_lines);
+		}
+	}
+
+	if (critical_section_entries % HOLD_SAMPLE_INTERVAL == 0) {
+		unsigned long long t0 = now_ns(), held_ns;
+
+		spin_ns(crit_time_ns());
+		held_ns = now_ns() - t0;
+		if (held_ns > clock_overhead_ns)
+			held_ns -= clock_overhead_ns;
+		hold_sampled_ns += held_ns;
+		hold_samples++;
+		hist_add(&hold_hist, held_ns);
+		return;
+	}
+
+	spin_ns(crit_time_ns());
+}
+
+/*
+ * Lock latencies of each thread. Only measured when measure_wait is
+ * set, to keep the clock reads off the default path.
+ *
+ * acquire : From calling lock() till the lock is acquired.
+ * handoff : From the previous holder calling unlock() till the lock is
+ *           acquired. Only recorded if the thread was already waiting
+ *           when the lock was released.
+ */
+int measure_wait = 0;
+int print_latency = 0;
+
+struct thread_latency {
+	struct lat_hist acquire;
+	struct lat_hist handoff;
+} __cacheline_aligned;
+
+static struct thread_latency *thread_latency;
+
+/* Time at which the last holder released the lock. Protected by the lock */
+unsigned long long last_unlock_ns;
+
+static void record_acquire(int id, unsigned long long begin_ns)
+{
+	struct thread_latency *tl = &thread_latency[id];
+	unsigned long long acquired_ns = now_ns();
+	unsigned long long unlock_ns = last_unlock_ns;
+
+	hist_add(&tl->acquire, acquired_ns - begin_ns);
+	if (unlock_ns > begin_ns)
+		hist_add(&tl->handoff, acquired_ns - unlock_ns);
+}
+
+/*
+ * Think time and arrivals.
+ *
+ * closed : (default) After a critical section the thread does
+ *          --think ns of non-critical work, spinning outside the lock,
+ *          before the next one.
+ * open   : The thread issues requests at arrival times spaced by
+ *          --think, independently of how long the earlier requests
+ *          took, idling in between if it is ahead. With exp: this
+ *          is a Poisson arrival process. The wait of a request is
+ *          measured from its arrival time, so it includes the time it
+ *          spent queued behind the earlier requests of the thread.
+ */
+#define ARRIVALS_CLOSED	0
+#define ARRIVALS_OPEN	1
+
+int arrivals = ARRIVALS_CLOSED;
+struct dist think_dist;
+
+struct thread_arrival {
+	unsigned long long next_ns;
+	unsigned int seed;
+} __cacheline_aligned;
+
+static struct thread_arrival thread_arrival[MAX_THREADS];
+
+static void idle_until(unsigned long long deadline_ns)
+{
+	unsigned long long now = now_ns();
+	struct timespec ts;
+
+	/* Sleep for the bulk of it, spin for the rest */
+	if (deadline_ns > now + 100 * NSECS_PER_USEC) {
+		unsigned long long sleep_ns = deadline_ns - now -
+			50 * NSECS_PER_USEC;
+
+		ts.tv_sec = sleep_ns / NSECS_PER_SEC;
+		ts.tv_nsec = sleep_ns % NSECS_PER_SEC;
+		nanosleep(&ts, NULL);
+	}
+
+	while (now_ns() < deadline_ns && !stop)
+		cpu_relax();
+}
+
+static void think(int id)
+{
+	struct thread_arrival *ta = &thread_arrival[id];
+
+	if (think_dist.type == DIST_NONE)
+		return;
+
+	if (arrivals == ARRIVALS_CLOSED) {
+		spin_ns(dist_sample(&think_dist, &ta->seed));
+		return;
+	}
+
+	if (!ta->next_ns)
+		ta->next_ns = now_ns();
+	ta->next_ns += dist_sample(&think_dist, &ta->seed);
+	idle_until(ta->next_ns);
+}
+
+/* Offered load in requests/s, assuming no waiting for the lock */
+static double offered_load(void)
+{
+	double per_request_ns = dist_mean(&think_dist);
+
+	if (arrivals == ARRIVALS_CLOSED)
+		per_request_ns += crit_dist.type == DIST_NONE ?
+			critical_section_time_ns : dist_mean(&crit_dist);
+
+	if (per_request_ns <= 0)
+		return 0;
+
+	return nr_threads * NSECS_PER_SEC / per_request_ns;
+}
+
+/*
+ * Lock holder preemption. With --detect-preempt, or when -n is given
+ * as a multiple of the allowed CPUs, every hold is timestamped and the
+ * ones that took longer than preempt_threshold_ns are counted as
+ * preempted. The threshold is --preempt-factor times the mean
+ * critical section length, and no less than PREEMPT_MIN_NS so that
+ * interrupts are not taken for preemptions.
+ *
+ * As a cross-check, on every HOLD_SAMPLE_INTERVAL-th entry of a thread
+ * the involuntary context switches of the thread
+ * (getrusage(RUSAGE_THREAD)) are read once lock() returns, and again
+ * if the hold turns out long. A sampled long hold is confirmed when
+ * the thread was switched out in between, i.e. while holding the
+ * lock. Switches while waiting for the lock do not count. Sampling
+ * keeps the syscall out of most holds, which it would slow down.
+ */
+#define PREEMPT_MIN_NS	(50 * NSECS_PER_USEC)
+
+int detect_preempt = 0;
+unsigned long preempt_factor = 10;
+unsigned long long preempt_threshold_ns;
+
+/* Contenders per allowed CPU given with -n <k>x, 0 otherwise */
+unsigned long oversubscribe = 0;
+int nr_allowed_cpus = 1;
+cpu_set_t allowed_cpuset;
+
+struct preempt_stats {
+	unsigned long long entries;
+	unsigned long long long_holds;
+	unsigned long long sampled_long_holds;
+	unsigned long long confirmed;
+	unsigned long long long_hold_ns;
+	unsigned long long nivcsw_before;
+	unsigned long long nivcsw;
+} __cacheline_aligned;
+
+static struct preempt_stats preempt_stats[MAX_THREADS];
+
+static long thread_nivcsw(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_THREAD, &ru)) {
+		perror("getrusage");
+		exit(1);
+	}
+
+	return ru.ru_nivcsw;
+}
+
+static void init_preempt_threshold(void)
+{
+	double mean_crit = crit_dist.type == DIST_NONE ?
+		critical_section_time_ns : dist_mean(&crit_dist);
+
+	preempt_threshold_ns = mean_crit * preempt_factor;
+	if (preempt_threshold_ns < PREEMPT_MIN_NS)
+		preempt_threshold_ns = PREEMPT_MIN_NS;
+}
+
+static void check_preempted_hold(int id, unsigned long long hold_ns,
+				 int sampled)
+{
+	struct preempt_stats *ps = &preempt_stats[id];
+
+	if (hold_ns <= preempt_threshold_ns)
+		return;
+
+	ps->long_holds++;
+	ps->long_hold_ns += hold_ns;
+	if (!sampled)
+		return;
+
+	ps->sampled_long_holds++;
+	if (thread_nivcsw() > ps->nivcsw_before)
+		ps->confirmed++;
+}
+
+/*
+ * Deadline-bounded acquisition. With --deadline-us, every lock() is
+ * given deadline_ns to succeed, using a timed FUTEX_WAIT. A thread
+ * that times out counts an SLO miss and skips the critical section,
+ * like a request handler giving up on a timed lock. The latency of
+ * the acquisitions that made it is recorded per thread. The deadline
+ * is checked before every CAS retry and FUTEX_WAIT, but an acquisition
+ * can still end after it when the thread was preempted or backed off
+ * after its last check. Those are counted as late.
+ */
+unsigned long long deadline_ns = 0;
+
+struct deadline_stats {
+	unsigned long long attempts;
+	unsigned long long misses;
+	unsigned long long late;
+	struct lat_hist acquired;
+} __cacheline_aligned;
+
+static struct deadline_stats *deadline_stats;
+
+static int deadline_lock(int id)
+{
+	struct deadline_stats *ds = &deadline_stats[id];
+	unsigned long long start_ns = now_ns(), lat_ns;
+
+	ds->attempts++;
+	if (lock_ops->lock_until(id, start_ns + deadline_ns)) {
+		ds->misses++;
+		return 0;
+	}
+
+	lat_ns = now_ns() - start_ns;
+	if (lat_ns > deadline_ns)
+		ds->late++;
+	hist_add(&ds->acquired, lat_ns);
+	return 1;
+}
+
+/*
+ * CPU accounting. Every thread reads its CLOCK_THREAD_CPUTIME_ID at
+ * the start and at the end of the run, which gives the CPU time spent
+ * per entry, whatever the lock.
+ *
+ * With --cpu-split, every HOLD_SAMPLE_INTERVAL-th entry of a thread
+ * also reads the thread CPU clock and the wall clock around lock() and
+ * the critical section, and splits the time into :
+ *
+ * spinning : CPU time in lock(), the retries and the syscall overhead.
+ * sleeping : Wall time in lock() that was not CPU time, i.e. blocked
+ *            in FUTEX_WAIT (or preempted). Costs no CPU.
+ * holding  : CPU time in the critical section.
+ *
+ * The sampled times are scaled up to all the entries of the thread,
+ * after taking out the cost of the clock reads in each of them.
+ * Whatever is left of the CPU time went to thinking and unlocking.
+ */
+int cpu_split = 0;
+
+/* Cost of a thread CPU clock read plus a wall clock read */
+unsigned long long cpu_clock_overhead_ns = 0;
+
+struct cpu_account {
+	unsigned long long cpu_ns;
+	unsigned long long entries;
+	unsigned long long samples;
+	unsigned long long spin_ns;
+	unsigned long long sleep_ns;
+	unsigned long long hold_ns;
+} __cacheline_aligned;
+
+static struct cpu_account cpu_account[MAX_THREADS];
+
+static unsigned long long thread_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * NSECS_PER_SEC + ts.tv_nsec;
+}
+
+static void calibrate_cpu_clock(void)
+{
+	unsigned long long t0, t1;
+	int i;
+
+	if (!cpu_split)
+		return;
+
+	cpu_clock_overhead_ns = ULLONG_MAX;
+	for (i = 0; i < CALIBRATE_ROUNDS * 100; i++) {
+		t0 = thread_cpu_ns();
+		now_ns();
+		t1 = thread_cpu_ns();
+		if (t1 - t0 < cpu_clock_overhead_ns)
+			cpu_clock_overhead_ns = t1 - t0;
+	}
+}
+
+static unsigned long long cpu_window_ns(unsigned long long t0,
+					unsigned long long t1)
+{
+	return t1 - t0 > cpu_clock_overhead_ns ?
+		t1 - t0 - cpu_clock_overhead_ns : 0;
+}
+
+static void critical_section(int id)
+{
+	unsigned long long begin_ns = 0, hold_start_ns = 0, hold_ns = 0;
+	unsigned long long cpu0, cpu1, cpu2, wall0, wall1;
+	struct cpu_account *ca = &cpu_account[id];
+	int sample_cpu = cpu_split &&
+		++ca->entries % HOLD_SAMPLE_INTERVAL == 0;
+	int sample_nivcsw = detect_preempt &&
+		++preempt_stats[id].entries % HOLD_SAMPLE_INTERVAL == 0;
+
+	thread_node[id] = current_node();
+	if (measure_wait) {
+		if (arrivals == ARRIVALS_OPEN && thread_arrival[id].next_ns)
+			begin_ns = thread_arrival[id].next_ns;
+		else
+			begin_ns = now_ns();
+	}
+
+	if (sample_cpu) {
+		cpu0 = thread_cpu_ns();
+		wall0 = now_ns();
+	}
+
+	if (!deadline_ns)
+		lock_ops->lock(id);
+	else if (!deadline_lock(id))
+		return;
+
+	if (sample_cpu) {
+		cpu1 = thread_cpu_ns();
+		wall1 = now_ns();
+	}
+
+	if (measure_wait)
+		record_acquire(id, begin_ns);
+
+	if (sample_nivcsw)
+		preempt_stats[id].nivcsw_before = thread_nivcsw();
+
+	if (detect_preempt)
+		hold_start_ns = now_ns();
+
+	critical_section_body(id, thread_node[id]);
+
+	if (sample_cpu) {
+		cpu2 = thread_cpu_ns();
+		ca->samples++;
+		ca->spin_ns += cpu_window_ns(cpu0, cpu1);
+		if (wall1 - wall0 > cpu1 - cpu0)
+			ca->sleep_ns += (wall1 - wall0) - (cpu1 - cpu0);
+		ca->hold_ns += cpu_window_ns(cpu1, cpu2);
+	}
+
+	if (detect_preempt)
+		hold_ns = now_ns() - hold_start_ns;
+
+	if (measure_wait)
+		last_unlock_ns = now_ns();
+
+	lock_ops->unlock(id);
+
+	if (detect_preempt)
+		check_preempted_hold(id, hold_ns, sample_nivcsw);
+}
+
+static void print_cpu_summary(void)
+{
+	double spin = 0, sleep = 0, hold = 0, cpu = 0, other, scale;
+	unsigned long long entries = 0;
+	int i;
+
+	for (i = 0; i < nr_threads; i++) {
+		struct cpu_account *ca = &cpu_account[i];
+
+		cpu += ca->cpu_ns;
+		entries += thread_entries[i];
+		if (!ca->samples)
+			continue;
+		scale = (double) thread_entries[i] / ca->samples;
+		spin += ca->spin_ns * scale;
+		sleep += ca->sleep_ns * scale;
+		hold += ca->hold_ns * scale;
+	}
+
+	if (!entries || !cpu)
+		return;
+
+	printf("CPU time = %6.3f s (%6.2f%% of %d threads), %6.1f CPU-ns per entry, %6.6f M entries per CPU-second\n",
+		cpu / NSECS_PER_SEC,
+		100.0 * cpu / ((double) timeout * NSECS_PER_SEC * nr_threads),
+		nr_threads, cpu / entries, entries / (cpu / NSECS_PER_SEC) / 1000000);
+
+	if (!cpu_split)
+		return;
+
+	/* The sampled entries can cost more than the others */
+	other = cpu > spin + hold ? cpu - spin - hold : 0;
+	printf("CPU split per entry : spinning = %6.1f ns (%6.2f%%), holding = %6.1f ns (%6.2f%%), other = %6.1f ns (%6.2f%%), sleeping = %6.1f ns off-CPU\n",
+		spin / entries, 100 * spin / cpu, hold / entries,
+		100 * hold / cpu, other / entries, 100 * other / cpu,
+		sleep / entries);
+}
+
+/*
+ * Jain's fairness index of the per-thread entries. 1 when all the
+ * threads got the same number of entries, 1/n when one thread got all.
+ */
+static double jain_fairness_index(void)
+{
+	double sum = 0, sum_sq = 0;
+	int i;
+
+	for (i = 0; i < nr_threads; i++) {
+		sum += thread_entries[i];
+		sum_sq += (double) thread_entries[i] * thread_entries[i];
+	}
+
+	if (sum_sq == 0)
+		return 0;
+
+	return (sum * sum) / (nr_threads * sum_sq);
+}
+
+static void print_futex_stats_summary(void)
+{
+	struct futex_stats total;
+	unsigned long long entries = 0;
+	char prefix[64];
+	int i;
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < nr_threads; i++) {
+		struct futex_stats *fs = &futex_stats[i];
+
+		sprintf(prefix, "Thread %d futex", i);
+		print_futex_stats_line(prefix, fs);
+
+		total.cas_attempts += fs->cas_attempts;
+		total.cas_failures += fs->cas_failures;
+		total.wait_calls += fs->wait_calls;
+		total.wait_eagain += fs->wait_eagain;
+		total.wake_calls += fs->wake_calls;
+		total.wake_woken += fs->wake_woken;
+		total.syscall_ns += fs->syscall_ns;
+		entries += thread_entries[i];
+	}
+
+	print_futex_stats_line("All threads futex", &total);
+
+	if (!entries)
+		return;
+
+	printf("Per entry : CAS = %6.3f, CAS failures = %6.3f, FUTEX_WAIT = %6.3f, EAGAIN = %6.3f, FUTEX_WAKE = %6.3f, wasted FUTEX_WAKE = %6.3f, syscall time = %6.1f ns\n",
+		(double) total.cas_attempts / entries,
+		(double) total.cas_failures / entries,
+		(double) total.wait_calls / entries,
+		(double) total.wait_eagain / entries,
+		(double) total.wake_calls / entries,
+		(double) (total.wake_calls - total.wake_woken) / entries,
+		(double) total.syscall_ns / entries);
+
+	if (total.cas_attempts)
+		printf("CAS failure rate = %6.2f%% (%s backoff)\n",
+			100.0 * total.cas_failures / total.cas_attempts,
+			backoff_names[backoff]);
+
+	if (total.wait_calls + total.wake_calls)
+		printf("Per futex syscall : %6.1f ns (%s futex ops)\n",
+			(double) total.syscall_ns /
+			(total.wait_calls + total.wake_calls),
+			futex_private ? "private" : "shared");
+}
+
+static void merge_acquire_latency(struct lat_hist *all)
+{
+	int i;
+
+	memset(all, 0, sizeof(*all));
+	for (i = 0; i < nr_threads; i++)
+		hist_merge(all, &thread_latency[i].acquire);
+}
+
+static void init_allowed_cpus(void)
+{
+	if (sched_getaffinity(0, sizeof(allowed_cpuset), &allowed_cpuset)) {
+		perror("sched_getaffinity");
+		exit(1);
+	}
+
+	nr_allowed_cpus = CPU_COUNT(&allowed_cpuset);
+}
+
+static void merge_preempt_stats(struct preempt_stats *total)
+{
+	int i;
+
+	memset(total, 0, sizeof(*total));
+	for (i = 0; i < nr_threads; i++) {
+		total->long_holds += preempt_stats[i].long_holds;
+		total->sampled_long_holds += preempt_stats[i].sampled_long_holds;
+		total->confirmed += preempt_stats[i].confirmed;
+		total->long_hold_ns += preempt_stats[i].long_hold_ns;
+		total->nivcsw += preempt_stats[i].nivcsw;
+	}
+}
+
+/*
+ * Estimate the entries that would have been made during the excess
+ * time of the long holds, at the rate of the rest of the run.
+ */
+static double preempt_lost_entries(struct preempt_stats *total)
+{
+	double mean_crit, run_ns, lost_ns, cycle_ns;
+
+	mean_crit = crit_dist.type == DIST_NONE ?
+		critical_section_time_ns : dist_mean(&crit_dist);
+	run_ns = (double) timeout * NSECS_PER_SEC;
+	lost_ns = total->long_hold_ns - total->long_holds * mean_crit;
+	if (critical_section_entries <= total->long_holds ||
+	    run_ns <= total->long_hold_ns)
+		return 0;
+
+	cycle_ns = (run_ns - total->long_hold_ns) /
+		(critical_section_entries - total->long_holds);
+	return lost_ns / cycle_ns;
+}
+
+static void print_preempt_summary(void)
+{
+	struct preempt_stats total;
+	double lost_entries;
+
+	if (nr_threads > nr_allowed_cpus)
+		printf("Oversubscription = %d threads on %d allowed CPUs (%.2f per CPU)\n",
+			nr_threads, nr_allowed_cpus,
+			(double) nr_threads / nr_allowed_cpus);
+
+	if (!detect_preempt)
+		return;
+
+	merge_preempt_stats(&total);
+
+	printf("Preempted holds (> %lld ns) = %lld (%6.3f%% of entries), %lld of %lld sampled confirmed by involuntary context switches\n",
+		preempt_threshold_ns, total.long_holds,
+		critical_section_entries ?
+		100.0 * total.long_holds / critical_section_entries : 0,
+		total.confirmed, total.sampled_long_holds);
+	printf("Involuntary context switches = %lld (%6.3f per entry)\n",
+		total.nivcsw, critical_section_entries ?
+		(double) total.nivcsw / critical_section_entries : 0);
+
+	lost_entries = preempt_lost_entries(&total);
+	printf("Lock held by preempted holders = %6.2f%% of the run, lost = %6.6f M entries/s (%6.2f%% of the throughput)\n",
+		100.0 * total.long_hold_ns / ((double) timeout * NSECS_PER_SEC),
+		lost_entries / timeout / 1000000,
+		critical_section_entries ?
+		100.0 * lost_entries / (critical_section_entries + lost_entries) : 0);
+}
+
+static void merge_deadline_stats(struct deadline_stats *all)
+{
+	int i;
+
+	memset(all, 0, sizeof(*all));
+	for (i = 0; i < nr_threads; i++) {
+		all->attempts += deadline_stats[i].attempts;
+		all->misses += deadline_stats[i].misses;
+		all->late += deadline_stats[i].late;
+		hist_merge(&all->acquired, &deadline_stats[i].acquired);
+	}
+}
+
+static void print_deadline_summary(void)
+{
+	struct deadline_stats *all;
+
+	if (!deadline_ns)
+		return;
+
+	all = malloc(sizeof(*all));
+	if (!all) {
+		perror("malloc");
+		exit(1);
+	}
+	merge_deadline_stats(all);
+
+	printf("Deadline = %lld us : SLO misses = %lld of %lld acquisitions (%6.3f%%), %6.6f M misses/s, %lld late successes\n",
+		deadline_ns / NSECS_PER_USEC, all->misses, all->attempts,
+		all->attempts ? 100.0 * all->misses / all->attempts : 0,
+		((double) all->misses / timeout) / 1000000, all->late);
+	print_hist("Successful acquisitions", &all->acquired);
+	free(all);
+}
+
+static void print_think_summary(void)
+{
+	struct lat_hist *all;
+	char desc[80];
+	double offered = offered_load(), mean_crit;
+
+	if (think_dist.type == DIST_NONE && crit_dist.type == DIST_NONE)
+		return;
+
+	mean_crit = crit_dist.type == DIST_NONE ?
+		critical_section_time_ns : dist_mean(&crit_dist);
+
+	dist_desc(&think_dist, desc);
+	printf("Think time = %s, arrivals = %s\n", desc,
+		arrivals == ARRIVALS_OPEN ? "open" : "closed");
+	dist_desc(&crit_dist, desc);
+	printf("Critical section length = %s\n",
+		crit_dist.type == DIST_NONE ? "fixed -c" : desc);
+	printf("Offered load = %6.6f M requests/s (lock utilization %6.2f%%), achieved = %6.6f M entries/s\n",
+		offered / 1000000, offered * mean_crit / NSECS_PER_SEC * 100,
+		((double) critical_section_entries/timeout)/1000000);
+
+	if (!measure_wait)
+		return;
+
+	all = malloc(sizeof(*all));
+	if (!all) {
+		perror("malloc");
+		exit(1);
+	}
+	merge_acquire_latency(all);
+	print_hist("Wait", all);
+	free(all);
+}
+
+static void print_latency_summary(void)
+{
+	struct lat_hist *all_acquire, *all_handoff;
+	char prefix[64];
+	int i;
+
+	all_acquire = calloc(1, sizeof(*all_acquire));
+	all_handoff = calloc(1, sizeof(*all_handoff));
+	if (!all_acquire || !all_handoff) {
+		perror("calloc");
+		exit(1);
+	}
+
+	/* The unlock time of another process is not seen with --process */
+	for (i = 0; i < nr_threads; i++) {
+		sprintf(prefix, "Thread %d acquire", i);
+		print_hist(prefix, &thread_latency[i].acquire);
+		hist_merge(all_acquire, &thread_latency[i].acquire);
+		if (use_processes)
+			continue;
+		sprintf(prefix, "Thread %d handoff", i);
+		print_hist(prefix, &thread_latency[i].handoff);
+		hist_merge(all_handoff, &thread_latency[i].handoff);
+	}
+
+	print_hist("All threads acquire", all_acquire);
+	if (!use_processes)
+		print_hist("All threads handoff", all_handoff);
+
+	free(all_acquire);
+	free(all_handoff);
+}
+
+/***********************************************************************
+ * Delegated execution of the Critical Section
+ *
+ * Instead of acquiring the lock itself, a thread posts its request in
+ * its own publication slot and waits for it to be executed.
+ *
+ * combining : Flat combining. The thread that succeeds in taking the
+ *             combiner lock executes all the pending requests in one
+ *             pass over the slots. The others spin on their slot,
+ *             retrying the combiner lock whenever it is free.
+ * server    : A dedicated server thread loops over the slots executing
+ *             the pending requests. The clients wait on their slot,
+ *             with a FUTEX_WAIT after fwait_retry_count spins.
+ *
+ * A slot is QNODE_WAITING (or QNODE_PARKED) while its request is
+ * pending and is flipped back to QNODE_GRANTED once it is executed.
+ ***********************************************************************/
+struct pub_slot {
+	int state;
+} __cacheline_aligned;
+
+static struct pub_slot pub_slots[MAX_THREADS];
+static int combiner_lock __cacheline_aligned;
+
+/* Protected by the combiner lock / owned by the server thread */
+unsigned long long combine_passes = 0;
+unsigned long long combined_requests = 0;
+
+/* Number of contending threads yet to exit. The server runs till then */
+int nr_active_clients;
+
+static void combine_requests(void)
+{
+	int node = current_node();
+	unsigned long batch = 0;
+	int i;
+
+	for (i = 0; i < nr_threads; i++) {
+		if (__atomic_load_n(&pub_slots[i].state, __ATOMIC_ACQUIRE) ==
+		    QNODE_GRANTED)
+			continue;
+
+		critical_section_body(i, node);
+		qnode_grant(&pub_slots[i].state);
+		batch++;
+	}
+
+	if (batch) {
+		combine_passes++;
+		combined_requests += batch;
+	}
+}
+
+static void combining_critical_section(int id)
+{
+	int *state = &pub_slots[id].state;
+
+	__atomic_store_n(state, QNODE_WAITING, __ATOMIC_RELEASE);
+
+	while (__atomic_load_n(state, __ATOMIC_ACQUIRE) != QNODE_GRANTED) {
+		if (!__atomic_load_n(&combiner_lock, __ATOMIC_RELAXED) &&
+		    !cmpxchg(&combiner_lock, 0, 1)) {
+			combine_requests();
+			__atomic_store_n(&combiner_lock, 0, __ATOMIC_RELEASE);
+		} else {
+			cpu_relax();
+		}
+	}
+}
+
+static void server_critical_section(int id)
+{
+	int *state = &pub_slots[id].state;
+
+	__atomic_store_n(state, QNODE_WAITING, __ATOMIC_RELEASE);
+	qnode_wait(state, 1);
+}
+
+static void print_combining_summary(void)
+{
+	printf("Combining passes = %lld (%6.2f requests/pass)\n",
+		combine_passes,
+		combine_passes ?
+		(double) combined_requests / combine_passes : 0);
+}
+
+static void *server_fn(void *arg)
+{
+	while (__atomic_load_n(&nr_active_clients, __ATOMIC_ACQUIRE) > 0)
+		combine_requests();
+
+	return NULL;
+}
+
+/***********************************************************************
+ * Reader-Writer lock
+ *
+ * A futex based rwlock. rw.state is the number of readers holding the
+ * lock or RW_WRITER when a writer holds it. Waiting readers and
+ * writers sleep on separate sequence counters, read_seq and write_seq,
+ * which the unlocker bumps before waking them up. The waiters sample
+ * the sequence counter before checking the lock state so that a
+ * wakeup between the check and the FUTEX_WAIT is not lost.
+ *
+ * With the writer policy, new readers queue up behind waiting writers.
+ * With the reader policy, readers get in as long as there is no writer
+ * holding the lock, so writers can starve. With the exclusive policy
+ * readers take the lock as writers, which models a plain mutex with
+ * the same read/write critical sections.
+ *
+ * Each thread does a read critical section with probability
+ * rw_read_pct % and a write critical section otherwise. Only write
+ * critical sections are counted in critical_section_entries and the
+ * node accounting, since concurrent readers cannot update shared
+ * counters.
+ ***********************************************************************/
+#define RW_WRITER	(-1)
+
+enum rw_policy {
+	RW_PREFER_WRITER,
+	RW_PREFER_READER,
+	RW_EXCLUSIVE,
+};
+
+const char *rw_policy_names[] = {
+	[RW_PREFER_WRITER] = "writer",
+	[RW_PREFER_READER] = "reader",
+	[RW_EXCLUSIVE] = "exclusive",
+};
+
+int rw_policy = RW_PREFER_WRITER;
+unsigned int rw_read_pct = 90;
+unsigned long long read_critical_section_time_ns = 0;
+int read_crittime_provided = 0;
+
+struct rwlock {
+	int state __cacheline_aligned;
+	int writers_waiting;
+	int readers_waiting;
+	int read_seq __cacheline_aligned;
+	int write_seq __cacheline_aligned;
+};
+
+static struct rwlock rw;
+
+struct rw_stats {
+	unsigned long long reads;
+	unsigned long long writes;
+	unsigned long long write_wait_ns;
+	unsigned long long write_wait_max_ns;
+	unsigned int seed;
+} __cacheline_aligned;
+
+static struct rw_stats rw_stats[MAX_THREADS];
+
+static void rw_wake(int *seq, int *nr_waiting, int nr_wake)
+{
+	__atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(nr_waiting, __ATOMIC_SEQ_CST))
+		futex(seq, FUTEX_WAKE_PRIVATE, nr_wake, NULL, NULL, 0);
+}
+
+static void rw_write_lock(void)
+{
+	int seq;
+
+	__atomic_add_fetch(&rw.writers_waiting, 1, __ATOMIC_SEQ_CST);
+	while (1) {
+		if (!cmpxchg(&rw.state, 0, RW_WRITER))
+			break;
+
+		seq = __atomic_load_n(&rw.write_seq, __ATOMIC_SEQ_CST);
+		if (!__atomic_load_n(&rw.state, __ATOMIC_SEQ_CST))
+			continue;
+
+		futex(&rw.write_seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+	}
+	__atomic_sub_fetch(&rw.writers_waiting, 1, __ATOMIC_SEQ_CST);
+}
+
+static void rw_write_unlock(void)
+{
+	__atomic_store_n(&rw.state, 0, __ATOMIC_SEQ_CST);
+
+	if (rw_policy == RW_PREFER_WRITER &&
+	    __atomic_load_n(&rw.writers_waiting, __ATOMIC_SEQ_CST)) {
+		rw_wake(&rw.write_seq, &rw.writers_waiting, 1);
+		return;
+	}
+
+	rw_wake(&rw.read_seq, &rw.readers_waiting, INT_MAX);
+	rw_wake(&rw.write_seq, &rw.writers_waiting, 1);
+}
+
+/* Can a new reader get in given the current lock state ? */
+static int rw_read_allowed(int state)
+{
+	if (state == RW_WRITER)
+		return 0;
+
+	if (rw_policy == RW_PREFER_WRITER &&
+	    __atomic_load_n(&rw.writers_waiting, __ATOMIC_SEQ_CST))
+		return 0;
+
+	return 1;
+}
+
+static void rw_read_lock(void)
+{
+	int state, seq;
+
+	if (rw_policy == RW_EXCLUSIVE) {
+		rw_write_lock();
+		return;
+	}
+
+	while (1) {
+		state = __atomic_load_n(&rw.state, __ATOMIC_SEQ_CST);
+		if (rw_read_allowed(state)) {
+			if (cmpxchg(&rw.state, state, state + 1) == state)
+				return;
+			continue;
+		}
+
+		__atomic_add_fetch(&rw.readers_waiting, 1, __ATOMIC_SEQ_CST);
+		seq = __atomic_load_n(&rw.read_seq, __ATOMIC_SEQ_CST);
+		state = __atomic_load_n(&rw.state, __ATOMIC_SEQ_CST);
+		if (!rw_read_allowed(state)) {
+			futex(&rw.read_seq, FUTEX_WAIT_PRIVATE, seq,
+			      NULL, NULL, 0);
+		}
+		__atomic_sub_fetch(&rw.readers_waiting, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+static void rw_read_unlock(void)
+{
+	if (rw_policy == RW_EXCLUSIVE) {
+		rw_write_unlock();
+		return;
+	}
+
+	/* The last reader out lets a waiting writer in */
+	if (__atomic_sub_fetch(&rw.state, 1, __ATOMIC_SEQ_CST) == 0)
+		rw_wake(&rw.write_seq, &rw.writers_waiting, 1);
+}
+
+static void rwlock_critical_section(int id)
+{
+	struct rw_stats *st = &rw_stats[id];
+	struct timespec begin, acquired;
+	unsigned long long wait_ns;
+
+	if (rand_r(&st->seed) % 100 < rw_read_pct) {
+		rw_read_lock();
+		st->reads++;
+		if (cs_lines)
+			cs_touch_lines(0);
+		spin_ns(read_critical_section_time_ns);
+		rw_read_unlock();
+		return;
+	}
+
+	clock_gettime(clockid, &begin);
+	rw_write_lock();
+	clock_gettime(clockid, &acquired);
+	critical_section_body(id, current_node());
+	rw_write_unlock();
+
+	wait_ns = compute_timediff(begin, acquired);
+	st->writes++;
+	st->write_wait_ns += wait_ns;
+	if (wait_ns > st->write_wait_max_ns)
+		st->write_wait_max_ns = wait_ns;
+}
+
+static void rwlock_init(void)
+{
+	int i;
+
+	if (!read_crittime_provided)
+		read_critical_section_time_ns = critical_section_time_ns;
+
+	for (i = 0; i < nr_threads; i++)
+		rw_stats[i].seed = i + 1;
+}
+
+static void print_rwlock_summary(void)
+{
+	unsigned long long reads = 0, writes = 0;
+	unsigned long long wait_ns = 0, wait_max_ns = 0;
+	int i;
+
+	for (i = 0; i < nr_threads; i++) {
+		reads += rw_stats[i].reads;
+		writes += rw_stats[i].writes;
+		wait_ns += rw_stats[i].write_wait_ns;
+		if (rw_stats[i].write_wait_max_ns > wait_max_ns)
+			wait_max_ns = rw_stats[i].write_wait_max_ns;
+	}
+
+	printf("RW policy = %s, read pct = %u%%, read crittime = %lld ns, write crittime = %lld ns\n",
+		rw_policy_names[rw_policy], rw_read_pct,
+		read_critical_section_time_ns, critical_section_time_ns);
+	printf("Read entries = %lld (%6.6f M entries/s)\n", reads,
+		((double) reads/timeout)/1000000);
+	printf("Write entries = %lld (%6.6f M entries/s)\n", writes,
+		((double) writes/timeout)/1000000);
+	printf("Writer wait : avg = %lld ns, max = %lld ns\n",
+		writes ? wait_ns / writes : 0, wait_max_ns);
+}
+
+/***********************************************************************
+ * Lock striping
+ *
+ * Instead of a single thread_mutex, there are nr_stripes fwait/fpost
+ * futex words, each guarding its own stripe of the data, as in a
+ * sharded hash table. For every entry a thread picks a stripe :
+ *
+ * uniform : uniformly at random.
+ * zipf    : Zipfian with exponent zipf_s, stripe 0 being the hottest.
+ * affine  : always stripe (id % nr_stripes).
+ *
+ * With the packed layout the futex words are adjacent, so several of
+ * them share a cache line. With the padded layout every word has a
+ * cache line of its own, which removes the false sharing.
+ *
+ * The per-stripe and per-thread counters live in cache lines of their
+ * own and are folded into thread_entries[] at the end of the run. With
+ * --process the futex words and the per-stripe counters are shared.
+ ***********************************************************************/
+#define MAX_STRIPES	(1 << 20)
+
+#define STRIPE_UNIFORM	0
+#define STRIPE_ZIPF	1
+#define STRIPE_AFFINE	2
+
+const char *stripe_select_names[] = {
+	[STRIPE_UNIFORM] = "uniform",
+	[STRIPE_ZIPF] = "zipf",
+	[STRIPE_AFFINE] = "affine",
+};
+
+unsigned long nr_stripes = 1;
+int stripe_select = STRIPE_UNIFORM;
+int stripe_padded = 0;
+double zipf_s = 0.99;
+
+static char *stripe_words;
+static size_t stripe_stride;
+static double *zipf_cdf;
+
+struct stripe_count {
+	unsigned long long entries;
+} __cacheline_aligned;
+
+static struct stripe_count *stripe_counts;
+
+struct stripe_thread {
+	unsigned long long entries;
+	unsigned int seed;
+} __cacheline_aligned;
+
+static struct stripe_thread stripe_threads[MAX_THREADS];
+
+static int *stripe_word(unsigned long k)
+{
+	return (int *)(stripe_words + k * stripe_stride);
+}
+
+static void striped_init(void)
+{
+	unsigned long k;
+	double sum = 0;
+	size_t size;
+
+	stripe_stride = stripe_padded ? CACHELINE_SIZE : sizeof(int);
+	size = (nr_stripes * stripe_stride + CACHELINE_SIZE - 1) &
+		~(CACHELINE_SIZE - 1);
+	if (use_processes) {
+		stripe_words = shared_alloc(size);
+		stripe_counts = shared_alloc(nr_stripes *
+					     sizeof(*stripe_counts));
+	} else {
+		stripe_words = aligned_alloc(CACHELINE_SIZE, size);
+		stripe_counts = aligned_alloc(CACHELINE_SIZE,
+					      nr_stripes * sizeof(*stripe_counts));
+	}
+	if (!stripe_words || !stripe_counts) {
+		perror("aligned_alloc");
+		exit(1);
+	}
+	memset(stripe_counts, 0, nr_stripes * sizeof(*stripe_counts));
+
+	for (k = 0; k < nr_stripes; k++)
+		*stripe_word(k) = AVAILABLE;
+
+	if (stripe_select == STRIPE_ZIPF) {
+		zipf_cdf = malloc(nr_stripes * sizeof(*zipf_cdf));
+		if (!zipf_cdf) {
+			perror("malloc");
+			exit(1);
+		}
+
+		for (k = 0; k < nr_stripes; k++) {
+			sum += 1.0 / pow(k + 1, zipf_s);
+			zipf_cdf[k] = sum;
+		}
+		for (k = 0; k < nr_stripes; k++)
+			zipf_cdf[k] /= sum;
+	}
+
+	for (k = 0; k < nr_threads; k++)
+		stripe_threads[k].seed = k + 1;
+}
+
+static unsigned long pick_stripe(int id)
+{
+	struct stripe_thread *st = &stripe_threads[id];
+	unsigned long lo, hi, mid;
+	double u;
+
+	switch (stripe_select) {
+	case STRIPE_AFFINE:
+		return id % nr_stripes;
+	case STRIPE_ZIPF:
+		u = rand_unit(&st->seed);
+		lo = 0;
+		hi = nr_stripes - 1;
+		while (lo < hi) {
+			mid = (lo + hi) / 2;
+			if (zipf_cdf[mid] < u)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return lo;
+	}
+
+	return rand_r(&st->seed) % nr_stripes;
+}
+
+static void striped_critical_section(int id)
+{
+	unsigned long k = pick_stripe(id);
+	int *futexp = stripe_word(k);
+
+	fwait(futexp);
+	stripe_counts[k].entries++;
+	stripe_threads[id].entries++;
+	/* Other stripes write the lines too, only the line traffic matters */
+	if (cs_lines)
+		cs_touch_lines(cs_write_lines);
+	spin_ns(crit_time_ns());
+	fpost(futexp, 1);
+}
+
+static void striped_finish(void)
+{
+	int i;
+
+	critical_section_entries = 0;
+	for (i = 0; i < nr_threads; i++) {
+		thread_entries[i] = stripe_threads[i].entries;
+		critical_section_entries += stripe_threads[i].entries;
+	}
+}
+
+static void print_striped_summary(void)
+{
+	unsigned long long min = ULLONG_MAX, max = 0;
+	unsigned long k, hottest = 0;
+
+	for (k = 0; k < nr_stripes; k++) {
+		if (stripe_counts[k].entries < min)
+			min = stripe_counts[k].entries;
+		if (stripe_counts[k].entries > max) {
+			max = stripe_counts[k].entries;
+			hottest = k;
+		}
+	}
+
+	printf("Stripes = %lu (%s layout, %s selection",
+		nr_stripes, stripe_padded ? "padded" : "packed",
+		stripe_select_names[stripe_select]);
+	if (stripe_select == STRIPE_ZIPF)
+		printf(", s = %.2f", zipf_s);
+	printf("), %lu futex words per cache line\n",
+		CACHELINE_SIZE / stripe_stride);
+	printf("Stripe entries : min = %lld, max = %lld (stripe %lu, %6.2f%% of entries)\n",
+		min, max, hottest, critical_section_entries ?
+		100.0 * max / critical_section_entries : 0);
+}
+
+/***********************************************************************
+ * Wake patterns
+ *
+ * Workloads where one futex wake releases many waiters :
+ *
+ * broadcast : Worker pool. Thread 0 waits for the other threads to be
+ *             waiting on a condition variable, bumps its generation
+ *             and wakes them all with FUTEX_WAKE. The whole herd then
+ *             contends for the fwait mutex to run its critical section.
+ * condvar   : Same, but the condition variable wakes one waiter and
+ *             moves the rest onto the mutex with FUTEX_CMP_REQUEUE, so
+ *             that each unlock of the mutex wakes the next one.
+ * barrier   : Sense-reversing futex barrier. Each thread spins for -c
+ *             ns and waits at the barrier, spinning -r times on the
+ *             sense before FUTEX_WAIT. The last one to arrive flips the
+ *             sense and wakes the others.
+ *
+ * For every waiter, the wake-to-run latency is the time from the wake
+ * (the broadcast or the sense flip) till it runs again, holding the
+ * mutex in the condition variable modes. The drain time is the time
+ * from the wake till the last of the waiters ran.
+ *
+ * These run their own loop till the end of the run, since a thread
+ * that stops on its own would leave the others waiting. The thread
+ * issuing the wake decides when to stop and tells the others with
+ * the same wake.
+ ***********************************************************************/
+struct condvar {
+	int seq __cacheline_aligned;
+	int generation;
+	int nr_waiting;
+	int nr_ran;
+	int done;
+	unsigned long long wake_ns;
+};
+
+static struct condvar cv;
+DEFINE_MUTEX(cv_mutex);
+
+struct futex_barrier {
+	int count __cacheline_aligned;
+	int nr_ran;
+	int done;
+	unsigned long long wake_ns;
+	int sense __cacheline_aligned;
+};
+
+static struct futex_barrier barrier_state;
+
+struct wake_stats {
+	struct lat_hist wake;
+} __cacheline_aligned;
+
+static struct wake_stats *wake_stats;
+static struct lat_hist *drain_hist;
+unsigned long long nr_wakes;
+
+/* Set for condvar, which requeues instead of waking all */
+int cv_requeue = 0;
+
+static void wake_init(void)
+{
+	wake_stats = calloc(nr_threads, sizeof(*wake_stats));
+	drain_hist = calloc(1, sizeof(*drain_hist));
+	if (!wake_stats || !drain_hist) {
+		perror("calloc");
+		exit(1);
+	}
+
+	memset(&cv, 0, sizeof(cv));
+	memset(&barrier_state, 0, sizeof(barrier_state));
+	barrier_state.count = nr_threads;
+	cv_mutex.futexval = AVAILABLE;
+	nr_wakes = 0;
+}
+
+static void condvar_init(void)
+{
+	cv_requeue = 1;
+	wake_init();
+}
+
+/* Called with cv_mutex held. Returns with cv_mutex held */
+static void cond_wait(struct condvar *c, struct mutex *m)
+{
+	int seq = c->seq;
+
+	mutex_unlock(m);
+	futex(&c->seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+	mutex_lock(m);
+}
+
+static void cond_broadcast(struct condvar *c, struct mutex *m, int seq)
+{
+	if (cv_requeue) {
+		/* Wake one, requeue the rest. nr_requeue goes in timeout */
+		futex(&c->seq, FUTEX_CMP_REQUEUE_PRIVATE, 1,
+		      (const struct timespec *) (unsigned long) INT_MAX,
+		      &m->futexval, seq);
+		return;
+	}
+
+	futex(&c->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Thread 0 : Broadcast every time all the others are waiting */
+static void cv_broadcaster(void)
+{
+	int nr_workers = nr_threads - 1;
+	int seq, done;
+
+	do {
+		while (__atomic_load_n(&cv.nr_waiting, __ATOMIC_ACQUIRE) <
+		       nr_workers && !stop)
+			sched_yield();
+
+		mutex_lock(&cv_mutex);
+		done = cv.done = stop;
+		cv.generation++;
+		cv.nr_waiting = 0;
+		cv.nr_ran = 0;
+		seq = __atomic_add_fetch(&cv.seq, 1, __ATOMIC_SEQ_CST);
+		nr_wakes++;
+		cv.wake_ns = now_ns();
+		mutex_unlock(&cv_mutex);
+
+		cond_broadcast(&cv, &cv_mutex, seq);
+	} while (!done);
+}
+
+static void cv_worker(int id)
+{
+	unsigned long long ran_ns;
+	int generation = 0;
+
+	mutex_lock(&cv_mutex);
+	while (!cv.done) {
+		__atomic_add_fetch(&cv.nr_waiting, 1, __ATOMIC_RELEASE);
+		while (cv.generation == generation)
+			cond_wait(&cv, &cv_mutex);
+		generation = cv.generation;
+
+		ran_ns = now_ns() - cv.wake_ns;
+		hist_add(&wake_stats[id].wake, ran_ns);
+		if (++cv.nr_ran == nr_threads - 1)
+			hist_add(drain_hist, ran_ns);
+
+		critical_section_body(id, current_node());
+	}
+	mutex_unlock(&cv_mutex);
+}
+
+static void cv_critical_section(int id)
+{
+	if (id == 0)
+		cv_broadcaster();
+	else
+		cv_worker(id);
+}
+
+static void barrier_critical_section(int id)
+{
+	struct futex_barrier *b = &barrier_state;
+	unsigned long long ran_ns;
+	unsigned long spins;
+	int sense = 0;
+
+	do {
+		spin_ns(crit_time_ns());
+		thread_entries[id]++;
+
+		sense = !sense;
+		if (__atomic_sub_fetch(&b->count, 1, __ATOMIC_ACQ_REL) == 0) {
+			/* Last one in : reset and release the others */
+			b->count = nr_threads;
+			b->nr_ran = 0;
+			b->done = stop;
+			nr_wakes++;
+			b->wake_ns = now_ns();
+			__atomic_store_n(&b->sense, sense, __ATOMIC_RELEASE);
+			futex(&b->sense, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+			continue;
+		}
+
+		spins = fwait_retry_count;
+		while (__atomic_load_n(&b->sense, __ATOMIC_ACQUIRE) != sense) {
+			if (spins) {
+				spins--;
+				cpu_relax();
+				continue;
+			}
+			futex(&b->sense, FUTEX_WAIT_PRIVATE, !sense, NULL, NULL, 0);
+		}
+
+		ran_ns = now_ns() - b->wake_ns;
+		hist_add(&wake_stats[id].wake, ran_ns);
+		if (__atomic_add_fetch(&b->nr_ran, 1, __ATOMIC_RELAXED) ==
+		    nr_threads - 1)
+			hist_add(drain_hist, ran_ns);
+	} while (!__atomic_load_n(&b->done, __ATOMIC_ACQUIRE));
+}
+
+static void barrier_finish(void)
+{
+	int i;
+
+	critical_section_entries = 0;
+	for (i = 0; i < nr_threads; i++)
+		critical_section_entries += thread_entries[i];
+}
+
+static void merge_wake_stats(struct lat_hist *all)
+{
+	int i;
+
+	memset(all, 0, sizeof(*all));
+	for (i = 0; i < nr_threads; i++)
+		hist_merge(all, &wake_stats[i].wake);
+}
+
+static void print_wake_summary(void)
+{
+	struct lat_hist *all;
+
+	all = malloc(sizeof(*all));
+	if (!all) {
+		perror("malloc");
+		exit(1);
+	}
+	merge_wake_stats(all);
+
+	printf("Wakes = %lld (%6.6f K wakes/s), %d waiters per wake, %s\n",
+		nr_wakes, (double) nr_wakes / timeout / 1000, nr_threads - 1,
+		cv_requeue ? "FUTEX_CMP_REQUEUE" : "FUTEX_WAKE all");
+	print_hist("Wake-to-run", all);
+	print_hist("Drain (last waiter)", drain_hist);
+	free(all);
+}
+
+/***********************************************************************
+ * Waiting on multiple locks
+ *
+ * Each contender takes whichever of the --nlocks (default 4) fwait
+ * futex words frees up first, using the striped lock words. A pass
+ * tries the CAS on every free word, starting from a random one. After
+ * -r failed passes the contender blocks :
+ *
+ * waitv      : In futex_waitv() on all the words at once (Linux 5.16+),
+ *              then makes another pass.
+ * waitv-poll : In fwait() on one word, a different one every time,
+ *              which is how it is done without futex_waitv().
+ *
+ * The acquire latency is from the first pass till a lock is taken.
+ * Both modes count the fwait/fpost futex stats as well, so that the
+ * syscalls per entry can be compared.
+ ***********************************************************************/
+#ifndef SYS_futex_waitv
+#define SYS_futex_waitv		449
+#endif
+
+/* From linux/futex.h of Linux 5.16+, for older headers */
+#ifndef FUTEX_32
+#define FUTEX_32		2
+#define FUTEX_WAITV_MAX		128
+
+struct futex_waitv {
+	__u64 val;
+	__u64 uaddr;
+	__u32 flags;
+	__u32 __reserved;
+};
+#endif
+
+#define DEFAULT_MULTI_LOCKS	4
+
+int nlocks_provided = 0;
+
+/* Set for waitv, clear for waitv-poll */
+int multi_waitv = 0;
+
+struct multi_stats {
+	struct lat_hist acquire;
+	unsigned long long waitv_calls;
+	unsigned long long waitv_eagain;
+	unsigned long long waitv_ns;
+	unsigned long home;
+} __cacheline_aligned;
+
+static struct multi_stats *multi_stats;
+static struct futex_waitv *multi_waiters;
+
+static long futex_waitv(struct futex_waitv *waiters, unsigned int nr,
+			unsigned int flags, struct timespec *timeout,
+			clockid_t clockid)
+{
+	return syscall(SYS_futex_waitv, waiters, nr, flags, timeout, clockid);
+}
+
+static void multi_init(void)
+{
+	unsigned long k;
+
+	if (!nlocks_provided)
+		nr_stripes = DEFAULT_MULTI_LOCKS;
+	if (multi_waitv && nr_stripes > FUTEX_WAITV_MAX) {
+		printf("futex_waitv can wait on at most %d locks\n",
+			FUTEX_WAITV_MAX);
+		exit(1);
+	}
+
+	striped_init();
+
+	multi_stats = calloc(nr_threads, sizeof(*multi_stats));
+	multi_waiters = calloc(nr_stripes, sizeof(*multi_waiters));
+	if (!multi_stats || !multi_waiters) {
+		perror("calloc");
+		exit(1);
+	}
+
+	for (k = 0; k < nr_stripes; k++) {
+		multi_waiters[k].uaddr = (unsigned long) stripe_word(k);
+		multi_waiters[k].val = BLOCKED;
+		multi_waiters[k].flags = FUTEX_32 | futex_private;
+	}
+
+	/* Syscall counts are part of the report */
+	print_futex_stats = 1;
+}
+
+static void waitv_init(void)
+{
+	/* No futexes is EINVAL if the syscall exists at all */
+	if (futex_waitv(NULL, 0, 0, NULL, CLOCK_MONOTONIC) == -1 &&
+	    errno == ENOSYS) {
+		printf("futex_waitv is not supported by this kernel (needs Linux 5.16 or later)\n");
+		exit(1);
+	}
+
+	multi_waitv = 1;
+	multi_init();
+}
+
+/* One pass over all the locks. Returns the one taken, -1 if none */
+static long multi_try_locks(int id)
+{
+	struct futex_stats *fs = my_futex_stats;
+	unsigned long i, k, start;
+	int *futexp;
+
+	start = rand_r(&stripe_threads[id].seed) % nr_stripes;
+	for (i = 0; i < nr_stripes; i++) {
+		k = (start + i) % nr_stripes;
+		futexp = stripe_word(k);
+		if (*(volatile int *)futexp != AVAILABLE)
+			continue;
+		if (unlikely(fs != NULL))
+			fs->cas_attempts++;
+		if (__sync_bool_compare_and_swap(futexp, AVAILABLE, BLOCKED))
+			return k;
+		if (unlikely(fs != NULL))
+			fs->cas_failures++;
+	}
+
+	return -1;
+}
+
+static unsigned long multi_acquire(int id)
+{
+	struct multi_stats *ms = &multi_stats[id];
+	unsigned long retries = fwait_retry_count;
+	unsigned long long start;
+	long k;
+
+	while (1) {
+		k = multi_try_locks(id);
+		if (k >= 0)
+			return k;
+
+		if (retries) {
+			retries--;
+			continue;
+		}
+		retries = fwait_retry_count;
+
+		if (!multi_waitv) {
+			ms->home = (ms->home + 1) % nr_stripes;
+			fwait(stripe_word(ms->home));
+			return ms->home;
+		}
+
+		ms->waitv_calls++;
+		start = now_ns();
+		if (futex_waitv(multi_waiters, nr_stripes, 0, NULL,
+				CLOCK_MONOTONIC) == -1) {
+			if (errno != EAGAIN) {
+				perror("futex_waitv");
+				exit(1);
+			}
+			ms->waitv_eagain++;
+		}
+		ms->waitv_ns += now_ns() - start;
+	}
+}
+
+static void multi_critical_section(int id)
+{
+	unsigned long long begin_ns = now_ns();
+	unsigned long k = multi_acquire(id);
+	int *futexp = stripe_word(k);
+
+	hist_add(&multi_stats[id].acquire, now_ns() - begin_ns);
+
+	stripe_counts[k].entries++;
+	stripe_threads[id].entries++;
+	if (cs_lines)
+		cs_touch_lines(cs_write_lines);
+	spin_ns(crit_time_ns());
+	fpost(futexp, 1);
+}
+
+static void print_multi_summary(void)
+{
+	struct lat_hist *all;
+	struct multi_stats total;
+	unsigned long long wait_calls = 0, wake_calls = 0;
+	int i;
+
+	all = calloc(1, sizeof(*all));
+	if (!all) {
+		perror("calloc");
+		exit(1);
+	}
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < nr_threads; i++) {
+		hist_merge(all, &multi_stats[i].acquire);
+		total.waitv_calls += multi_stats[i].waitv_calls;
+		total.waitv_eagain += multi_stats[i].waitv_eagain;
+		total.waitv_ns += multi_stats[i].waitv_ns;
+		wait_calls += futex_stats[i].wait_calls;
+		wake_calls += futex_stats[i].wake_calls;
+	}
+
+	printf("Locks = %lu (%s layout), blocking in %s\n", nr_stripes,
+		stripe_padded ? "padded" : "packed",
+		multi_waitv ? "futex_waitv on all of them" :
+		"fwait on one of them");
+	print_hist("Acquire", all);
+	if (multi_waitv)
+		printf("futex_waitv = %lld (%lld EAGAIN), syscall time = %lld ns\n",
+			total.waitv_calls, total.waitv_eagain, total.waitv_ns);
+	if (critical_section_entries)
+		printf("Syscalls per entry : futex_waitv = %6.3f, FUTEX_WAIT = %6.3f, FUTEX_WAKE = %6.3f\n",
+			(double) total.waitv_calls / critical_section_entries,
+			(double) wait_calls / critical_section_entries,
+			(double) wake_calls / critical_section_entries);
+	free(all);
+}
+
+/*
+ * concurrent : Critical sections run at the same time under different
+ * locks (or none), so the accounting of critical_section_body() per
+ * node, per sampled hold and per shared data touch does not apply.
+ */
+struct exec_mode {
+	const char *name;
+	const char *desc;
+	void (*critical_section)(int id);
+	int needs_server;
+	int concurrent;
+	void (*init)(void);
+	void (*finish)(void);
+	void (*print_summary)(void);
+};
+
+static struct exec_mode exec_table[] = {
+	{
+		.name = "direct",
+		.desc = "Every thread takes the lock and runs its own request",
+		.critical_section = critical_section,
+	},
+	{
+		.name = "combining",
+		.desc = "Flat combining, the combiner runs all posted requests",
+		.critical_section = combining_critical_section,
+		.print_summary = print_combining_summary,
+	},
+	{
+		.name = "server",
+		.desc = "A dedicated server thread runs all posted requests",
+		.critical_section = server_critical_section,
+		.needs_server = 1,
+		.print_summary = print_combining_summary,
+	},
+	{
+		.name = "rwlock",
+		.desc = "Futex rwlock, --read-pct of the entries are reads",
+		.critical_section = rwlock_critical_section,
+		.init = rwlock_init,
+		.print_summary = print_rwlock_summary,
+	},
+	{
+		.name = "striped",
+		.desc = "--nlocks fwait/fpost locks, one picked per entry",
+		.critical_section = striped_critical_section,
+		.concurrent = 1,
+		.init = striped_init,
+		.finish = striped_finish,
+		.print_summary = print_striped_summary,
+	},
+	{
+		.name = "broadcast",
+		.desc = "Condvar worker pool, FUTEX_WAKE of all waiters",
+		.critical_section = cv_critical_section,
+		.init = wake_init,
+		.print_summary = print_wake_summary,
+	},
+	{
+		.name = "condvar",
+		.desc = "Condvar worker pool, FUTEX_CMP_REQUEUE to the mutex",
+		.critical_section = cv_critical_section,
+		.init = condvar_init,
+		.print_summary = print_wake_summary,
+	},
+	{
+		.name = "barrier",
+		.desc = "Sense-reversing futex barrier, -c ns between waits",
+		.critical_section = barrier_critical_section,
+		.concurrent = 1,
+		.init = wake_init,
+		.finish = barrier_finish,
+		.print_summary = print_wake_summary,
+	},
+	{
+		.name = "waitv",
+		.desc = "Take any of --nlocks locks, futex_waitv on all of them",
+		.critical_section = multi_critical_section,
+		.concurrent = 1,
+		.init = waitv_init,
+		.finish = striped_finish,
+		.print_summary = print_multi_summary,
+	},
+	{
+		.name = "waitv-poll",
+		.desc = "Take any of --nlocks locks, fwait on one at a time",
+		.critical_section = multi_critical_section,
+		.concurrent = 1,
+		.init = multi_init,
+		.finish = striped_finish,
+		.print_summary = print_multi_summary,
+	},
+};
+
+#define NR_EXEC_MODES	(sizeof(exec_table) / sizeof(exec_table[0]))
+
+/* How the critical section is executed. Defaults to direct */
+struct exec_mode *exec_mode = &exec_table[0];
+
+static struct exec_mode *find_exec_mode(const char *name)
+{
+	int i;
+
+	for (i = 0; i < NR_EXEC_MODES; i++) {
+		if (!strcmp(exec_table[i].name, name))
+			return &exec_table[i];
+	}
+
+	return NULL;
+}
+
+
+/* Signal handler to be called when the global timeout is done */
+static void sigalrm_handler(int junk)
+{
+	printf("Timeout complete. Stopping all threads\n");
+	stop = 1;
+}
+
+/* Timeout of the contender processes other than 0 with --process */
+static void sigalrm_quiet_handler(int junk)
+{
+	stop = 1;
+}
+
+/***********************************************************************
+ * Thread scheduling
+ *
+ * --sched assigns a scheduling class and an optional CPU to ranges of
+ * contending threads : <threads>:fifo:<prio>[:<cpu>] for SCHED_FIFO
+ * with the given RT priority, or <threads>:nice:<n>[:<cpu>] for
+ * SCHED_OTHER with the given nice value. <threads> is a thread index
+ * or a range a-b. Multiple specs are separated by commas.
+ *
+ * --hogs=<n>:<prio>:<cpu> creates n CPU hog threads pinned to <cpu>
+ * that spin without touching the lock, at SCHED_FIFO priority <prio>
+ * (SCHED_OTHER if 0). Combined with a low priority lock holder on the
+ * same CPU and a high priority waiter elsewhere, this shows priority
+ * inversion, and whether the PI locks avoid it.
+ ***********************************************************************/
+#define SCHED_UNSET	0
+#define SCHED_SET_FIFO	1
+#define SCHED_SET_NICE	2
+
+struct thread_sched {
+	int type;
+	int value;
+	int cpu;
+};
+
+static struct thread_sched thread_sched[MAX_THREADS];
+
+int nr_hogs = 0;
+struct thread_sched hog_sched = {.type = SCHED_UNSET, .cpu = -1};
+
+static void init_thread_sched(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_THREADS; i++) {
+		thread_sched[i].type = SCHED_UNSET;
+		thread_sched[i].cpu = -1;
+	}
+}
+
+static void parse_thread_sched(char *spec)
+{
+	char *tok, *saveptr;
+
+	for (tok = strtok_r(spec, ",", &saveptr); tok;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		struct thread_sched ts = {.cpu = -1};
+		int first, last, i, n;
+		char class[8];
+
+		n = sscanf(tok, "%d-%d:%7[a-z]:%d:%d", &first, &last, class,
+			   &ts.value, &ts.cpu);
+		if (n < 4) {
+			n = sscanf(tok, "%d:%7[a-z]:%d:%d", &first, class,
+				   &ts.value, &ts.cpu);
+			last = first;
+			n++;
+		}
+
+		if (n < 4 || first < 0 || last >= MAX_THREADS || first > last) {
+			printf("Invalid sched spec %s\n", tok);
+			exit(1);
+		}
+
+		if (!strcmp(class, "fifo")) {
+			ts.type = SCHED_SET_FIFO;
+		} else if (!strcmp(class, "nice")) {
+			ts.type = SCHED_SET_NICE;
+		} else {
+			printf("Invalid sched class %s\n", class);
+			exit(1);
+		}
+
+		for (i = first; i <= last; i++)
+			thread_sched[i] = ts;
+	}
+
+	measure_wait = 1;
+}
+
+static void parse_hogs(char *spec)
+{
+	if (sscanf(spec, "%d:%d:%d", &nr_hogs, &hog_sched.value,
+		   &hog_sched.cpu) != 3) {
+		printf("Invalid hogs spec %s\n", spec);
+		exit(1);
+	}
+
+	hog_sched.type = hog_sched.value ? SCHED_SET_FIFO : SCHED_UNSET;
+}
+
+/* Apply the scheduling class and CPU affinity to the calling thread */
+static void apply_thread_sched(struct thread_sched *ts)
+{
+	if (ts->cpu >= 0) {
+		cpu_set_t cpuset;
+
+		CPU_ZERO(&cpuset);
+		CPU_SET(ts->cpu, &cpuset);
+		if (sched_setaffinity(0, sizeof(cpuset), &cpuset)) {
+			perror("sched_setaffinity");
+			exit(1);
+		}
+	}
+
+	if (ts->type == SCHED_SET_FIFO) {
+		struct sched_param param = {.sched_priority = ts->value};
+
+		if (sched_setscheduler(0, SCHED_FIFO, &param)) {
+			perror("sched_setscheduler");
+			exit(1);
+		}
+	} else if (ts->type == SCHED_SET_NICE) {
+		if (setpriority(PRIO_PROCESS, gettid(), ts->value)) {
+			perror("setpriority");
+			exit(1);
+		}
+	}
+}
+
+static void sched_desc(struct thread_sched *ts, char *buf)
+{
+	if (ts->type == SCHED_SET_FIFO)
+		sprintf(buf, "fifo %d", ts->value);
+	else if (ts->type == SCHED_SET_NICE)
+		sprintf(buf, "nice %d", ts->value);
+	else
+		sprintf(buf, "default");
+
+	if (ts->cpu >= 0)
+		sprintf(buf + strlen(buf), ", cpu %d", ts->cpu);
+}
+
+static void *hog_fn(void *arg)
+{
+	apply_thread_sched(&hog_sched);
+
+	while (!stop)
+		cpu_relax();
+
+	return NULL;
+}
+
+/***********************************************************************
+ * Thread placement
+ *
+ * --placement pins contending thread i to placement_cpus[i % n], an
+ * ordering of the allowed CPUs built from the sysfs topology :
+ *
+ * compact      : Fill all the SMT siblings of a core, then the next
+ *                core of the same node, then the next node.
+ * scatter      : One thread per core, round-robin over the nodes,
+ *                before using any second SMT sibling.
+ * smt-siblings : Only the SMT siblings of the first core.
+ * one-per-core : Only the first SMT sibling of every core.
+ * one-node     : Only the CPUs of the first node, compact.
+ * cross-node   : Alternate between the nodes, compact within each.
+ *
+ * A CPU given with --sched takes precedence over the placement.
+ ***********************************************************************/
+#define PLACEMENT_NONE		0
+#define PLACEMENT_COMPACT	1
+#define PLACEMENT_SCATTER	2
+#define PLACEMENT_SMT_SIBLINGS	3
+#define PLACEMENT_ONE_PER_CORE	4
+#define PLACEMENT_ONE_NODE	5
+#define PLACEMENT_CROSS_NODE	6
+
+#define NR_PLACEMENTS		7
+
+const char *placement_names[] = {
+	[PLACEMENT_NONE] = "none",
+	[PLACEMENT_COMPACT] = "compact",
+	[PLACEMENT_SCATTER] = "scatter",
+	[PLACEMENT_SMT_SIBLINGS] = "smt-siblings",
+	[PLACEMENT_ONE_PER_CORE] = "one-per-core",
+	[PLACEMENT_ONE_NODE] = "one-node",
+	[PLACEMENT_CROSS_NODE] = "cross-node",
+};
+
+int placement = PLACEMENT_NONE;
+
+/* Run once per placement with --placement=all */
+int placement_sweep = 0;
+
+int placement_cpus[MAX_CPUS];
+int nr_placement_cpus;
+
+struct placement_cpu {
+	int cpu;
+	int node;
+	int core;
+	int sibling;	/* Index among the allowed siblings of the core */
+	int core_idx;	/* Index of the core within the node */
+	int node_idx;	/* Index of the CPU within the node, compact */
+	int key[3];
+};
+
+static int placement_cmp(const void *a, const void *b)
+{
+	const struct placement_cpu *pa = a, *pb = b;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		if (pa->key[i] != pb->key[i])
+			return pa->key[i] < pb->key[i] ? -1 : 1;
+	}
+
+	return pa->cpu - pb->cpu;
+}
+
+static void build_placement(void)
+{
+	struct placement_cpu *pc;
+	int cpu, i, n = 0;
+
+	nr_placement_cpus = 0;
+	if (placement == PLACEMENT_NONE)
+		return;
+
+	pc = calloc(MAX_CPUS, sizeof(*pc));
+	if (!pc) {
+		perror("calloc");
+		exit(1);
+	}
+
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		if (!CPU_ISSET(cpu, &allowed_cpuset))
+			continue;
+		pc[n].cpu = cpu;
+		pc[n].node = cpu_node[cpu] * MAX_CPUS + cpu_package[cpu];
+		pc[n].core = cpu_core[cpu];
+		pc[n].key[0] = pc[n].node;
+		pc[n].key[1] = pc[n].core;
+		pc[n].key[2] = cpu;
+		n++;
+	}
+
+	/* Compact order first, to number the siblings, cores and CPUs */
+	qsort(pc, n, sizeof(*pc), placement_cmp);
+	for (i = 0; i < n; i++) {
+		if (i && pc[i].node == pc[i - 1].node) {
+			pc[i].node_idx = pc[i - 1].node_idx + 1;
+			if (pc[i].core == pc[i - 1].core) {
+				pc[i].core_idx = pc[i - 1].core_idx;
+				pc[i].sibling = pc[i - 1].sibling + 1;
+			} else {
+				pc[i].core_idx = pc[i - 1].core_idx + 1;
+			}
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		switch (placement) {
+		case PLACEMENT_SCATTER:
+			pc[i].key[0] = pc[i].sibling;
+			pc[i].key[1] = pc[i].core_idx;
+			pc[i].key[2] = pc[i].node;
+			break;
+		case PLACEMENT_CROSS_NODE:
+			pc[i].key[0] = pc[i].node_idx;
+			pc[i].key[1] = pc[i].node;
+			pc[i].key[2] = 0;
+			break;
+		}
+	}
+	qsort(pc, n, sizeof(*pc), placement_cmp);
+
+	for (i = 0; i < n; i++) {
+		if (placement == PLACEMENT_SMT_SIBLINGS &&
+		    pc[i].core != pc[0].core)
+			continue;
+		if (placement == PLACEMENT_ONE_PER_CORE && pc[i].sibling)
+			continue;
+		if (placement == PLACEMENT_ONE_NODE &&
+		    pc[i].node != pc[0].node)
+			continue;
+		placement_cpus[nr_placement_cpus++] = pc[i].cpu;
+	}
+
+	free(pc);
+}
+
+/* CPU that thread id is pinned to, -1 if none */
+static int thread_cpu(int id)
+{
+	if (thread_sched[id].cpu >= 0)
+		return thread_sched[id].cpu;
+	if (!nr_placement_cpus)
+		return -1;
+
+	return placement_cpus[id % nr_placement_cpus];
+}
+
+static void apply_placement(int id)
+{
+	cpu_set_t cpuset;
+
+	if (thread_sched[id].cpu >= 0 || !nr_placement_cpus)
+		return;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(thread_cpu(id), &cpuset);
+	if (sched_setaffinity(0, sizeof(cpuset), &cpuset)) {
+		perror("sched_setaffinity");
+		exit(1);
+	}
+}
+
+/* Number of CPUs, cores and nodes used by the nr_threads threads */
+static void placement_span(int *cpus, int *cores, int *nodes)
+{
+	static char seen[3][MAX_CPUS];
+	int i, cpu;
+
+	memset(seen, 0, sizeof(seen));
+	*cpus = *cores = *nodes = 0;
+	for (i = 0; i < nr_threads; i++) {
+		cpu = thread_cpu(i);
+		if (cpu < 0)
+			continue;
+		if (!seen[0][cpu]) {
+			seen[0][cpu] = 1;
+			(*cpus)++;
+		}
+		if (!seen[1][cpu_core[cpu]]) {
+			seen[1][cpu_core[cpu]] = 1;
+			(*cores)++;
+		}
+		if (!seen[2][cpu_node[cpu]]) {
+			seen[2][cpu_node[cpu]] = 1;
+			(*nodes)++;
+		}
+	}
+}
+
+static void print_placement_summary(void)
+{
+	int cpus, cores, nodes;
+
+	if (placement == PLACEMENT_NONE)
+		return;
+
+	placement_span(&cpus, &cores, &nodes);
+	printf("Placement = %s, %d threads on %d CPUs, %d cores, %d nodes\n",
+		placement_names[placement], nr_threads, cpus, cores, nodes);
+}
+
+/***********************************************************************
+ * Contending Threads
+ ***********************************************************************/
+
+static void *thread_fn(void *arg)
+{
+	int my_idx = *((int *)arg);
+	struct timespec cur;
+	unsigned long long cpu_start = thread_cpu_ns();
+
+	thread_kernel_tid[my_idx] = gettid();
+	if (print_futex_stats)
+		my_futex_stats = &futex_stats[my_idx];
+	apply_thread_sched(&thread_sched[my_idx]);
+	apply_placement(my_idx);
+
+	clock_gettime(clockid, &cur);
+	debug_printf("[%lld.%lld] %d thread is active\n",
+		cur.tv_sec, cur.tv_nsec, my_idx);
+
+	debug_printf("critical section time = %lld ns\n", critical_section_time_ns);
+	if (my_idx == 0) {
+		/* Set an alarm for the global timeout */
+		signal(SIGALRM, sigalrm_handler);
+		alarm(timeout);
+	} else if (use_processes) {
+		/* Every contender process needs its own */
+		signal(SIGALRM, sigalrm_quiet_handler);
+		alarm(timeout);
+	}
+
+	thread_arrival[my_idx].seed = my_idx + 1;
+	crit_seed = MAX_THREADS + my_idx + 1;
+	while (!stop) {
+		think(my_idx);
+		if (stop)
+			break;
+		exec_mode->critical_section(my_idx);
+	}
+
+	if (detect_preempt)
+		preempt_stats[my_idx].nivcsw = thread_nivcsw();
+	cpu_account[my_idx].cpu_ns = thread_cpu_ns() - cpu_start;
+
+	__atomic_sub_fetch(&nr_active_clients, 1, __ATOMIC_RELEASE);
+
+	clock_gettime(clockid, &cur);
+	debug_printf("[%lld.%lld] %d thread exiting...\n",
+		cur.tv_sec, cur.tv_nsec, my_idx);
+	
+	return NULL;
+}
+
+/***********************************************************************
+ * Contending Processes
+ *
+ * With --process every contender is a process forked from here, which
+ * runs thread_fn() and exits. The locks and the shared data are set up
+ * with shared_alloc() before the fork. The counters of a contender are
+ * private to its process, so it copies them to its proc_result slot
+ * on exit and the parent folds them in. The cross-node handoffs and
+ * the handoff latency depend on the previous holder, so they are not
+ * reported in this mode.
+ ***********************************************************************/
+struct proc_result {
+	unsigned long entries;
+	unsigned long long node_entries[MAX_NODES];
+	unsigned long long hold_samples;
+	unsigned long long hold_sampled_ns;
+	struct lat_hist hold_hist;
+	unsigned long long cs_touch_samples;
+	unsigned long long cs_touch_sampled_ns;
+	struct futex_stats futex_stats;
+	struct preempt_stats preempt;
+	struct cpu_account cpu;
+	struct thread_latency latency;
+};
+
+static struct proc_result *proc_results;
+
+static void process_fn(int id)
+{
+	struct proc_result *res = &proc_results[id];
+
+	thread_fn(&id);
+
+	if (exec_mode->finish)
+		exec_mode->finish();
+
+	res->entries = thread_entries[id];
+	memcpy(res->node_entries, node_entries, sizeof(node_entries));
+	res->hold_samples = hold_samples;
+	res->hold_sampled_ns = hold_sampled_ns;
+	res->hold_hist = hold_hist;
+	res->cs_touch_samples = cs_touch_samples;
+	res->cs_touch_sampled_ns = cs_touch_sampled_ns;
+	res->futex_stats = futex_stats[id];
+	res->preempt = preempt_stats[id];
+	res->cpu = cpu_account[id];
+	if (measure_wait)
+		res->latency = thread_latency[id];
+
+	fflush(stdout);
+	_exit(0);
+}
+
+static void run_processes(void)
+{
+	pid_t pids[MAX_THREADS];
+	int i, j, status;
+
+	proc_results = shared_alloc(nr_threads * sizeof(*proc_results));
+
+	fflush(stdout);
+	for (i = 0; i < nr_threads; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			perror("fork");
+			exit(1);
+		}
+		if (pids[i] == 0)
+			process_fn(i);
+	}
+
+	/* The --hogs threads stay in this process and need the timeout too */
+	signal(SIGALRM, sigalrm_quiet_handler);
+	alarm(timeout);
+
+	for (i = 0; i < nr_threads; i++) {
+		if (waitpid(pids[i], &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status)) {
+			printf("Contender process %d failed\n", i);
+			exit(1);
+		}
+	}
+
+	critical_section_entries = 0;
+	for (i = 0; i < nr_threads; i++) {
+		struct proc_result *res = &proc_results[i];
+
+		thread_entries[i] = res->entries;
+		critical_section_entries += res->entries;
+		for (j = 0; j < MAX_NODES; j++)
+			node_entries[j] += res->node_entries[j];
+		hold_samples += res->hold_samples;
+		hold_sampled_ns += res->hold_sampled_ns;
+		hist_merge(&hold_hist, &res->hold_hist);
+		cs_touch_samples += res->cs_touch_samples;
+		cs_touch_sampled_ns += res->cs_touch_sampled_ns;
+		futex_stats[i] = res->futex_stats;
+		preempt_stats[i] = res->preempt;
+		cpu_account[i] = res->cpu;
+		if (measure_wait)
+			thread_latency[i] = res->latency;
+	}
+}
+
+void print_usage(int argc, char *argv[])
+{
+	int i;
+
+	printf("Usage: %s [OPTIONS]\n", argv[0]);
+	printf("Following options are available\n");
+	printf("-n, --nthreads\t\t\t Number of contending threads, or <k>x for k per allowed CPU\n");
+	printf("-c, --crittime\t\t\t Time in ns spent inside critical section\n");
+	printf("-r, --retrycount\t\t The number of userspace retries before making futex syscall\n");
+	printf("-t, --timeout\t\t\t Time in seconds for program to run\n");
+	printf("-l, --lock=<name>\t\t Lock implementation guarding the critical section\n");
+	for (i = 0; i < NR_LOCK_TYPES; i++)
+		printf("\t\t\t\t   %-18s %s%s\n", lock_table[i].name,
+			lock_table[i].desc, i == 0 ? " (default)" : "");
+	printf("    --cohort-limit=<n>\t\t Max consecutive intra-node handoffs for cohort lock (default %lu)\n",
+		cohort_limit);
+	printf("    --barge-limit=<n>\t\t Times the oldest waiter may lose the lock to bargers for fwait-bounded (default %lu)\n",
+		barge_limit);
+	printf("-e, --exec=<mode>\t\t Who executes the critical section. --lock only applies to direct\n");
+	for (i = 0; i < NR_EXEC_MODES; i++)
+		printf("\t\t\t\t   %-18s %s%s\n", exec_table[i].name,
+			exec_table[i].desc, i == 0 ? " (default)" : "");
+	printf("    --spin=<mode>\t\t Critical section spin : calibrated (default) or clock\n");
+	printf("    --cs-lines=<n>\t\t Cache lines of shared data touched in each critical section (default 0)\n");
+	printf("    --cs-write-pct=<pct>\t Percentage of those lines that are written (default %u)\n",
+		cs_write_pct);
+	printf("    --think=<dist>\t\t Think time between entries : fixed:<ns>, exp:<mean ns> or\n");
+	printf("\t\t\t\t bimodal:<ns1>:<ns2>:<pct of ns1>\n");
+	printf("    --arrivals=<type>\t\t closed (think after each entry, default) or open (arrivals spaced by think)\n");
+	printf("    --crit-dist=<dist>\t\t Draw each critical section length from <dist> instead of -c\n");
+	printf("    --nlocks=<k>\t\t Number of striped locks (selects --exec=striped if no other -e)\n");
+	printf("    --stripe-select=<sel>\t Stripe picked per entry : uniform (default), zipf or affine\n");
+	printf("    --zipf-s=<s>\t\t Zipf exponent for --stripe-select=zipf (default %.2f)\n",
+		zipf_s);
+	printf("    --layout=<layout>\t\t Striped futex words : packed (default) or padded to a cache line\n");
+	printf("    --process\t\t\t Contenders are processes sharing the lock (fwait lock or striped exec)\n");
+	printf("    --futex-shared\t\t Use shared instead of private futex ops in fwait/fpost\n");
+	printf("    --backoff=<policy>\t\t fwait retry backoff : none (default), pause, exponential,\n");
+	printf("\t\t\t\t proportional or yield\n");
+	printf("    --backoff-max=<n>\t\t Max cpu_relax() loops of exponential/proportional backoff (default %lu)\n",
+		backoff_max);
+	printf("    --read-pct=<pct>\t\t Percentage of read critical sections with rwlock (default %u)\n",
+		rw_read_pct);
+	printf("    --read-crittime=<ns>\t Time in ns spent inside read critical section (default -c)\n");
+	printf("    --rw-policy=<policy>\t rwlock policy : writer (default), reader or exclusive\n");
+	printf("    --sched=<spec>\t\t Per-thread scheduling, <threads>:fifo|nice:<value>[:<cpu>],...\n");
+	printf("    --hogs=<n>:<prio>:<cpu>\t n CPU hogs at SCHED_FIFO <prio> (0 = SCHED_OTHER) pinned to <cpu>\n");
+	printf("    --placement=<policy>\t Pin the threads : compact, scatter, smt-siblings, one-per-core,\n");
+	printf("\t\t\t\t one-node, cross-node, or all to run once per policy\n");
+	printf("    --sweep-think=<range>\t Run once per mean think time in <start>:<end>[:<step>]\n");
+	printf("    --latency\t\t\t Report acquire and handoff latency percentiles per thread\n");
+	printf("    --futex-stats\t\t Count fwait/fpost CAS, FUTEX_WAIT/WAKE calls and syscall time\n");
+	printf("    --sweep-retry=<range>\t Run once per -r value in <start>:<end>[:<step>] (step xN multiplies)\n");
+	printf("    --sweep-crittime=<range>\t Run once per -c value in <start>:<end>[:<step>]\n");
+	printf("    --sweep-backoff\t\t Run once per --backoff policy and report the hold inflation\n");
+	printf("    --hold-inflation\t\t Compare the holds against the -c spin timed alone (calibrated spin)\n");
+	printf("    --sweep-threads=<steps>\t Run with 1 up to -n threads, linear or pow2 steps, and fit the USL\n");
+	printf("    --cpu-split\t\t Split the thread CPU time into spinning, holding and sleeping\n");
+	printf("    --detect-preempt\t\t Time every hold and count the preempted holders (implied by -n <k>x)\n");
+	printf("    --preempt-factor=<n>\t Holds longer than n times the critical section are preempted (default %lu)\n",
+		preempt_factor);
+	printf("    --deadline-us=<us>\t\t Give up on lock() after us, skipping the critical section (SLO miss)\n");
+	printf("-h, --help\t\t\t Print this message\n");
+}
+
+struct range {
+	unsigned long long start;
+	unsigned long long end;
+	unsigned long long step;
+	int multiply;
+};
+
+int sweep_mode = 0;
+
+#define THREAD_SWEEP_NONE	0
+#define THREAD_SWEEP_LINEAR	1
+#define THREAD_SWEEP_POW2	2
+
+int thread_sweep = THREAD_SWEEP_NONE;
+struct range sweep_retry;
+struct range sweep_crittime;
+struct range sweep_think;
+
+static void parse_range(char *arg, struct range *r)
+{
+	char step[32] = "x10";
+	int n;
+
+	n = sscanf(arg, "%llu:%llu:%31s", &r->start, &r->end, step);
+	if (n == 1)
+		r->end = r->start;
+	if (n < 1 || r->end < r->start) {
+		printf("Invalid range %s\n", arg);
+		exit(1);
+	}
+
+	r->multiply = (step[0] == 'x');
+	r->step = strtoull(step + r->multiply, NULL, 10);
+	if ((r->multiply && r->step < 2) || (!r->multiply && !r->step)) {
+		printf("Invalid range step %s\n", step);
+		exit(1);
+	}
+}
+
+/* Long options that have no short equivalent */
+enum {
+	OPT_COHORT_LIMIT = 256,
+	OPT_READ_PCT,
+	OPT_READ_CRITTIME,
+	OPT_RW_POLICY,
+	OPT_SCHED,
+	OPT_HOGS,
+	OPT_LATENCY,
+	OPT_FUTEX_STATS,
+	OPT_SWEEP_RETRY,
+	OPT_SWEEP_CRITTIME,
+	OPT_SWEEP_THREADS,
+	OPT_SPIN,
+	OPT_CS_LINES,
+	OPT_CS_WRITE_PCT,
+	OPT_THINK,
+	OPT_ARRIVALS,
+	OPT_CRIT_DIST,
+	OPT_SWEEP_THINK,
+	OPT_NLOCKS,
+	OPT_STRIPE_SELECT,
+	OPT_ZIPF_S,
+	OPT_LAYOUT,
+	OPT_PROCESS,
+	OPT_FUTEX_SHARED,
+	OPT_BACKOFF,
+	OPT_BACKOFF_MAX,
+	OPT_DETECT_PREEMPT,
+	OPT_PREEMPT_FACTOR,
+	OPT_PLACEMENT,
+	OPT_CPU_SPLIT,
+	OPT_SWEEP_BACKOFF,
+	OPT_BARGE_LIMIT,
+	OPT_DEADLINE,
+	OPT_HOLD_INFLATION,
+};
+
+void parse_args(int argc, char *argv[])
+{
+	int c, i;
+	char *end;
+
+	int iteration_length_provided = 0;
+	int cache_size_provided = 0;
+
+	while(1) {
+		static struct option long_options[] = {
+			{"nthreads", required_argument, 0, 'n'},
+			{"crittime", required_argument, 0, 'c'},
+			{"retrycount", required_argument, 0, 'r'},
+			{"timeout", required_argument, 0, 't'},
+			{"lock", required_argument, 0, 'l'},
+			{"cohort-limit", required_argument, 0, OPT_COHORT_LIMIT},
+			{"barge-limit", required_argument, 0, OPT_BARGE_LIMIT},
+			{"exec", required_argument, 0, 'e'},
+			{"read-pct", required_argument, 0, OPT_READ_PCT},
+			{"read-crittime", required_argument, 0, OPT_READ_CRITTIME},
+			{"rw-policy", required_argument, 0, OPT_RW_POLICY},
+			{"sched", required_argument, 0, OPT_SCHED},
+			{"hogs", required_argument, 0, OPT_HOGS},
+			{"latency", no_argument, 0, OPT_LATENCY},
+			{"futex-stats", no_argument, 0, OPT_FUTEX_STATS},
+			{"sweep-retry", required_argument, 0, OPT_SWEEP_RETRY},
+			{"sweep-crittime", required_argument, 0, OPT_SWEEP_CRITTIME},
+			{"sweep-threads", required_argument, 0, OPT_SWEEP_THREADS},
+			{"spin", required_argument, 0, OPT_SPIN},
+			{"cs-lines", required_argument, 0, OPT_CS_LINES},
+			{"cs-write-pct", required_argument, 0, OPT_CS_WRITE_PCT},
+			{"think", required_argument, 0, OPT_THINK},
+			{"arrivals", required_argument, 0, OPT_ARRIVALS},
+			{"crit-dist", required_argument, 0, OPT_CRIT_DIST},
+			{"sweep-think", required_argument, 0, OPT_SWEEP_THINK},
+			{"nlocks", required_argument, 0, OPT_NLOCKS},
+			{"stripe-select", required_argument, 0, OPT_STRIPE_SELECT},
+			{"zipf-s", required_argument, 0, OPT_ZIPF_S},
+			{"layout", required_argument, 0, OPT_LAYOUT},
+			{"process", no_argument, 0, OPT_PROCESS},
+			{"futex-shared", no_argument, 0, OPT_FUTEX_SHARED},
+			{"backoff", required_argument, 0, OPT_BACKOFF},
+			{"backoff-max", required_argument, 0, OPT_BACKOFF_MAX},
+			{"detect-preempt", no_argument, 0, OPT_DETECT_PREEMPT},
+			{"preempt-factor", required_argument, 0, OPT_PREEMPT_FACTOR},
+			{"deadline-us", required_argument, 0, OPT_DEADLINE},
+			{"placement", required_argument, 0, OPT_PLACEMENT},
+			{"cpu-split", no_argument, 0, OPT_CPU_SPLIT},
+			{"sweep-backoff", no_argument, 0, OPT_SWEEP_BACKOFF},
+			{"hold-inflation", no_argument, 0, OPT_HOLD_INFLATION},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0},
+		};
 
-		c = getopt_long(argc, argv, "hn:c:r:t:", long_options, &option_index);
+		int option_index = 0;
+		int cpu;
+
+		c = getopt_long(argc, argv, "hn:c:r:t:l:e:", long_options, &option_index);
 
 		/* Options are done */
 		if (c == -1)
@@ -340,29 +4432,291 @@ void parse_args(int argc, char *argv[])
 				printf(" with arg %s", optarg);
 			printf("\n");
 			break;
-		case 'h':
-			print_usage(argc, argv);
-			exit(0);
+		case 'h':
+			print_usage(argc, argv);
+			exit(0);
+
+		case 'n':
+			nr_threads = (int) strtoul(optarg, &end, 10);
+			if (*end == 'x') {
+				/* <k>x : k threads per allowed CPU */
+				oversubscribe = nr_threads;
+				nr_threads *= nr_allowed_cpus;
+				detect_preempt = 1;
+			}
+			if (nr_threads > MAX_THREADS) {
+				nr_threads = MAX_THREADS;
+				printf("Capping number of threads to %d\n",
+					nr_threads);
+			}
+			break;
+
+		case 'c':
+			critical_section_time_ns = strtoul(optarg, NULL, 10);
+			break;
+
+		case 'r':
+			fwait_retry_count = strtoul(optarg, NULL, 10);
+			break;
+
+		case 't':
+			timeout = strtoul(optarg, NULL, 10);
+			break;
+
+		case 'l':
+			lock_ops = find_lock_ops(optarg);
+			if (!lock_ops) {
+				printf("Unknown lock %s\n", optarg);
+				print_usage(argc, argv);
+				exit(1);
+			}
+			break;
+
+		case 'e':
+			exec_mode = find_exec_mode(optarg);
+			if (!exec_mode) {
+				printf("Unknown exec mode %s\n", optarg);
+				print_usage(argc, argv);
+				exit(1);
+			}
+			break;
+
+		case OPT_COHORT_LIMIT:
+			cohort_limit = strtoul(optarg, NULL, 10);
+			break;
+
+		case OPT_BARGE_LIMIT:
+			barge_limit = strtoul(optarg, NULL, 10);
+			break;
+
+		case OPT_READ_PCT:
+			rw_read_pct = strtoul(optarg, NULL, 10);
+			if (rw_read_pct > 100) {
+				printf("Read percentage should be <= 100\n");
+				exit(1);
+			}
+			break;
+
+		case OPT_READ_CRITTIME:
+			read_critical_section_time_ns = strtoul(optarg, NULL, 10);
+			read_crittime_provided = 1;
+			break;
+
+		case OPT_RW_POLICY:
+			for (i = 0; i < sizeof(rw_policy_names) / sizeof(rw_policy_names[0]); i++) {
+				if (!strcmp(optarg, rw_policy_names[i]))
+					break;
+			}
+			if (i == sizeof(rw_policy_names) / sizeof(rw_policy_names[0])) {
+				printf("Unknown rwlock policy %s\n", optarg);
+				print_usage(argc, argv);
+				exit(1);
+			}
+			rw_policy = i;
+			break;
+
+		case OPT_SCHED:
+			parse_thread_sched(optarg);
+			break;
+
+		case OPT_HOGS:
+			parse_hogs(optarg);
+			break;
+
+		case OPT_LATENCY:
+			measure_wait = 1;
+			print_latency = 1;
+			break;
+
+		case OPT_FUTEX_STATS:
+			print_futex_stats = 1;
+			break;
+
+		case OPT_SWEEP_RETRY:
+			parse_range(optarg, &sweep_retry);
+			sweep_mode = 1;
+			break;
+
+		case OPT_SWEEP_CRITTIME:
+			parse_range(optarg, &sweep_crittime);
+			sweep_mode = 1;
+			break;
+
+		case OPT_SPIN:
+			if (!strcmp(optarg, "calibrated")) {
+				spin_mode = SPIN_CALIBRATED;
+			} else if (!strcmp(optarg, "clock")) {
+				spin_mode = SPIN_CLOCK;
+			} else {
+				printf("Unknown spin mode %s\n", optarg);
+				print_usage(argc, argv);
+				exit(1);
+			}
+			break;
+
+		case OPT_CS_LINES:
+			cs_lines = strtoul(optarg, NULL, 10);
+			if (cs_lines > MAX_CS_LINES) {
+				cs_lines = MAX_CS_LINES;
+				printf("Capping shared data to %lu lines\n",
+					cs_lines);
+			}
+			break;
+
+		case OPT_CS_WRITE_PCT:
+			cs_write_pct = strtoul(optarg, NULL, 10);
+			if (cs_write_pct > 100) {
+				printf("Write percentage should be <= 100\n");
+				exit(1);
+			}
+			break;
+
+		case OPT_THINK:
+			parse_dist(optarg, &think_dist);
+			break;
+
+		case OPT_ARRIVALS:
+			if (!strcmp(optarg, "closed")) {
+				arrivals = ARRIVALS_CLOSED;
+			} else if (!strcmp(optarg, "open")) {
+				arrivals = ARRIVALS_OPEN;
+				measure_wait = 1;
+			} else {
+				printf("Unknown arrivals %s\n", optarg);
+				print_usage(argc, argv);
+				exit(1);
+			}
+			break;
+
+		case OPT_CRIT_DIST:
+			parse_dist(optarg, &crit_dist);
+			break;
+
+		case OPT_SWEEP_THINK:
+			parse_range(optarg, &sweep_think);
+			break;
+
+		case OPT_NLOCKS:
+			nr_stripes = strtoul(optarg, NULL, 10);
+			if (!nr_stripes || nr_stripes > MAX_STRIPES) {
+				printf("Number of locks should be between 1 and %d\n",
+					MAX_STRIPES);
+				exit(1);
+			}
+			nlocks_provided = 1;
+			if (exec_mode == &exec_table[0])
+				exec_mode = find_exec_mode("striped");
+			break;
+
+		case OPT_STRIPE_SELECT:
+			for (i = 0; i < sizeof(stripe_select_names) / sizeof(stripe_select_names[0]); i++) {
+				if (!strcmp(optarg, stripe_select_names[i]))
+					break;
+			}
+			if (i == sizeof(stripe_select_names) / sizeof(stripe_select_names[0])) {
+				printf("Unknown stripe selection %s\n", optarg);
+				print_usage(argc, argv);
+				exit(1);
+			}
+			stripe_select = i;
+			break;
+
+		case OPT_ZIPF_S:
+			zipf_s = strtod(optarg, NULL);
+			break;
+
+		case OPT_LAYOUT:
+			if (!strcmp(optarg, "packed")) {
+				stripe_padded = 0;
+			} else if (!strcmp(optarg, "padded")) {
+				stripe_padded = 1;
+			} else {
+				printf("Unknown layout %s\n", optarg);
+				print_usage(argc, argv);
+				exit(1);
+			}
+			break;
+
+		case OPT_PROCESS:
+			use_processes = 1;
+			futex_private = 0;
+			break;
+
+		case OPT_FUTEX_SHARED:
+			futex_private = 0;
+			break;
+
+		case OPT_BACKOFF:
+			for (i = 0; i < sizeof(backoff_names) / sizeof(backoff_names[0]); i++) {
+				if (!strcmp(optarg, backoff_names[i]))
+					break;
+			}
+			if (i == sizeof(backoff_names) / sizeof(backoff_names[0])) {
+				printf("Unknown backoff %s\n", optarg);
+				print_usage(argc, argv);
+				exit(1);
+			}
+			backoff = i;
+			break;
+
+		case OPT_SWEEP_BACKOFF:
+			backoff_sweep = 1;
+			hold_inflation = 1;
+			break;
+
+		case OPT_HOLD_INFLATION:
+			hold_inflation = 1;
+			break;
+
+		case OPT_CPU_SPLIT:
+			cpu_split = 1;
+			break;
+
+		case OPT_PLACEMENT:
+			if (!strcmp(optarg, "all")) {
+				placement_sweep = 1;
+				break;
+			}
+			for (i = 0; i < NR_PLACEMENTS; i++) {
+				if (!strcmp(optarg, placement_names[i]))
+					break;
+			}
+			if (i == NR_PLACEMENTS) {
+				printf("Unknown placement %s\n", optarg);
+				print_usage(argc, argv);
+				exit(1);
+			}
+			placement = i;
+			break;
 
-		case 'n':
-			nr_threads = (int) strtoul(optarg, NULL, 10);
-			if (nr_threads > MAX_THREADS) {
-				nr_threads = MAX_THREADS;
-				printf("Capping number of threads to %d\n",
-					nr_threads);
-			}
+		case OPT_DETECT_PREEMPT:
+			detect_preempt = 1;
 			break;
 
-		case 'c':
-			critical_section_time_ns = strtoul(optarg, NULL, 10);
+		case OPT_PREEMPT_FACTOR:
+			preempt_factor = strtoul(optarg, NULL, 10);
 			break;
 
-		case 'r':
-			fwait_retry_count = strtoul(optarg, NULL, 10);
+		case OPT_DEADLINE:
+			deadline_ns = strtoull(optarg, NULL, 10) * NSECS_PER_USEC;
 			break;
 
-		case 't':
-			timeout = strtoul(optarg, NULL, 10);
+		case OPT_BACKOFF_MAX:
+			backoff_max = strtoul(optarg, NULL, 10);
+			if (!backoff_max)
+				backoff_max = 1;
+			break;
+
+		case OPT_SWEEP_THREADS:
+			if (!strcmp(optarg, "linear")) {
+				thread_sweep = THREAD_SWEEP_LINEAR;
+			} else if (!strcmp(optarg, "pow2")) {
+				thread_sweep = THREAD_SWEEP_POW2;
+			} else {
+				printf("Unknown thread sweep %s\n", optarg);
+				print_usage(argc, argv);
+				exit(1);
+			}
 			break;
 
 		default:
@@ -371,12 +4725,33 @@ void parse_args(int argc, char *argv[])
 			exit(1);
 		}
 	}
+
+	if (detect_preempt && exec_mode->critical_section != critical_section) {
+		printf("Lock holder preemption is only detected with --exec=direct\n");
+		exit(1);
+	}
+
+	if (deadline_ns &&
+	    (exec_mode->critical_section != critical_section ||
+	     !lock_ops->lock_until || use_processes)) {
+		printf("--deadline-us needs --exec=direct with a timed lock (fwait) and threads\n");
+		exit(1);
+	}
+
+	if (use_processes &&
+	    strcmp(exec_mode->name, "striped") &&
+	    (exec_mode->critical_section != critical_section ||
+	     strcmp(lock_ops->name, "fwait"))) {
+		printf("--process needs --lock=fwait or --exec=striped\n");
+		exit(1);
+	}
 }
 
 
 
 
-int main(int argc, char *argv[])
+/* Create the contending threads and wait for them to finish the run */
+static void run_benchmark(void)
 {
 	int i;
 
@@ -387,10 +4762,62 @@ int main(int argc, char *argv[])
 	pthread_t watchdog_tid;
 	pthread_attr_t watchdog_attr;
 
-	parse_args(argc, argv);
-	setpgid(getpid(), getpid());
+	pthread_t server_tid;
+	pthread_t hog_tid[MAX_THREADS];
+
+	if (lock_ops->init)
+		lock_ops->init();
+
+	if (exec_mode->init)
+		exec_mode->init();
+
+	if (hold_inflation && spin_mode == SPIN_CALIBRATED)
+		measure_isolated_hold();
+
+	if (detect_preempt) {
+		init_preempt_threshold();
+		memset(preempt_stats, 0, sizeof(preempt_stats));
+	}
+
+	if (measure_wait) {
+		thread_latency = calloc(nr_threads, sizeof(*thread_latency));
+		if (!thread_latency) {
+			perror("calloc");
+			exit(1);
+		}
+	}
+
+	if (deadline_ns) {
+		deadline_stats = calloc(nr_threads, sizeof(*deadline_stats));
+		if (!deadline_stats) {
+			perror("calloc");
+			exit(1);
+		}
+	}
+
+	nr_active_clients = nr_threads;
+	if (exec_mode->needs_server &&
+	    pthread_create(&server_tid, NULL, server_fn, NULL)) {
+		printf("Error creating server thread\n");
+		exit(1);
+	}
+
+	if (nr_hogs > MAX_THREADS)
+		nr_hogs = MAX_THREADS;
+
+	for (i = 0; i < nr_hogs; i++) {
+		if (pthread_create(&hog_tid[i], NULL, hog_fn, NULL)) {
+			printf("Error creating hog thread %d\n", i);
+			exit(1);
+		}
+	}
 	
 
+	if (use_processes) {
+		run_processes();
+		goto join_hogs;
+	}
+
 	for (i = 0; i < nr_threads; i++) {
 		thread_args[i] = i;
 		
@@ -408,18 +4835,734 @@ int main(int argc, char *argv[])
 		pthread_join(thread_tid[i], NULL);
 	}
 
-	
+	if (exec_mode->needs_server)
+		pthread_join(server_tid, NULL);
+
+	if (exec_mode->finish)
+		exec_mode->finish();
+
 	for (i = 0; i < nr_threads; i++)
 		pthread_attr_destroy(&thread_attr[i]);
 
+join_hogs:
+	for (i = 0; i < nr_hogs; i++)
+		pthread_join(hog_tid[i], NULL);
+}
+
+static void print_hold_summary(void)
+{
+	printf("Critical section hold : requested = %lld ns, measured = %lld ns (%lld samples)\n",
+		critical_section_time_ns,
+		hold_samples ? hold_sampled_ns / hold_samples : 0,
+		hold_samples);
+	if (hold_inflation && spin_mode == SPIN_CALIBRATED &&
+	    hold_samples && isolated_hold_ns && crit_dist.type == DIST_NONE)
+		printf("Hold inflation : p50 = %lld ns vs %lld ns isolated (%6.3fx), p99 = %lld ns\n",
+			hist_percentile(&hold_hist, 50), isolated_hold_ns,
+			(double) hist_percentile(&hold_hist, 50) / isolated_hold_ns,
+			hist_percentile(&hold_hist, 99));
+}
+
+static void print_results(void)
+{
+	int i;
+
 	for (i = 0; i < nr_threads; i++) {
-		printf("Thread %d = %ld entries\n", i,
-			thread_entries[i]);
+		if (nr_placement_cpus)
+			printf("Thread %d = %ld entries (CPU %d)\n", i,
+				thread_entries[i], thread_cpu(i));
+		else
+			printf("Thread %d = %ld entries\n", i,
+				thread_entries[i]);
+		if (measure_wait) {
+			char desc[64];
+
+			sched_desc(&thread_sched[i], desc);
+			printf("Thread %d wait : avg = %lld ns, max = %lld ns (%s)\n",
+				i, thread_latency[i].acquire.count ?
+				thread_latency[i].acquire.sum_ns /
+				thread_latency[i].acquire.count : 0,
+				thread_latency[i].acquire.max_ns, desc);
+		}
+	}
+
+	for (i = 0; i < nr_nodes && !exec_mode->concurrent; i++) {
+		printf("Node %d = %lld entries (%6.6f M entries/s)\n", i,
+			node_entries[i],
+			((double) node_entries[i]/timeout)/1000000);
 	}
 
+	if (print_latency)
+		print_latency_summary();
+
+	print_think_summary();
+
+	if (print_futex_stats)
+		print_futex_stats_summary();
+
+	printf("Jain's fairness index = %6.6f\n", jain_fairness_index());
+
+	print_cpu_summary();
+
+	if (nr_hogs) {
+		char desc[64];
+
+		sched_desc(&hog_sched, desc);
+		printf("CPU hogs = %d (%s)\n", nr_hogs, desc);
+	}
+
+	print_preempt_summary();
+	print_deadline_summary();
+	print_placement_summary();
+
+	if (!use_processes && !exec_mode->concurrent)
+		printf("Cross-node handoffs = %lld (%6.2f%% of entries)\n",
+			cross_node_handoffs,
+			critical_section_entries ?
+			(100.0 * cross_node_handoffs) / critical_section_entries : 0);
+
+	printf("Contenders = %s, fwait/fpost futex ops = %s\n",
+		use_processes ? "processes" : "threads",
+		futex_private ? "private" : "shared");
+
+	printf("fwait retries = %lu, backoff = %s", fwait_retry_count,
+		backoff_names[backoff]);
+	if (backoff == BACKOFF_EXPONENTIAL || backoff == BACKOFF_PROPORTIONAL)
+		printf(" (max %lu cpu_relax)", backoff_max);
+	printf("\n");
+
+	if (exec_mode->critical_section == critical_section) {
+		printf("Lock = %s\n", lock_ops->name);
+		if (lock_ops->print_summary)
+			lock_ops->print_summary();
+	} else {
+		printf("Exec mode = %s\n", exec_mode->name);
+	}
+
+	if (exec_mode->print_summary)
+		exec_mode->print_summary();
+
+	if (spin_mode == SPIN_CALIBRATED)
+		printf("Spin = calibrated (%.4f loops/ns)\n", spin_loops_per_ns);
+	else
+		printf("Spin = clock\n");
+
+	if (!exec_mode->concurrent) {
+		print_cs_data_summary();
+		print_hold_summary();
+	}
+
+
 	printf("The number of entries in the critical section = %lld (%6.6f M entries/s)\n",
 		critical_section_entries,
 		((double) critical_section_entries/timeout)/1000000);
+}
+
+/***********************************************************************
+ * Retry-count x Critical section time sweep
+ *
+ * Runs the benchmark once for every combination of the -r and -c
+ * values in the --sweep-retry and --sweep-crittime ranges, and prints
+ * the throughput along with the system wide %usr/%sys/%idle from
+ * /proc/stat and the CPU time used by the run from its rusage.
+ *
+ * Each run is a forked child, so that it starts from a clean state.
+ * The child reports its number of entries through a pipe and its
+ * output is discarded.
+ *
+ * A range is <start>:<end>[:<step>]. A step of the form xN multiplies
+ * the value by N (default x10), otherwise the step is added.
+ ***********************************************************************/
+static unsigned long long range_next(struct range *r, unsigned long long v)
+{
+	if (r->multiply)
+		return v ? v * r->step : 1;
+
+	return v + r->step;
+}
+
+struct cpu_times {
+	unsigned long long usr;
+	unsigned long long sys;
+	unsigned long long idle;
+	unsigned long long total;
+};
+
+static void read_proc_stat(struct cpu_times *ct)
+{
+	unsigned long long user, nice, system, idle, iowait, irq, softirq;
+	unsigned long long steal = 0;
+	FILE *fp;
+
+	fp = fopen("/proc/stat", "r");
+	if (!fp || fscanf(fp, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+			  &user, &nice, &system, &idle, &iowait, &irq,
+			  &softirq, &steal) < 7) {
+		perror("/proc/stat");
+		exit(1);
+	}
+	fclose(fp);
+
+	ct->usr = user + nice;
+	ct->sys = system + irq + softirq;
+	ct->idle = idle + iowait;
+	ct->total = ct->usr + ct->sys + ct->idle + steal;
+}
+
+struct sweep_result {
+	unsigned long long crittime;
+	unsigned long long retry;
+	unsigned long long entries;
+	double usr_pct;
+	double sys_pct;
+	double idle_pct;
+	double cpu_secs;
+	unsigned long long think_ns;
+	unsigned long long wait_p50_ns;
+	unsigned long long wait_p99_ns;
+	unsigned long long wait_p999_ns;
+	unsigned long long hold_p50_ns;
+	unsigned long long isolated_hold_ns;
+	unsigned long long cas_attempts;
+	unsigned long long cas_failures;
+	unsigned long long deadline_attempts;
+	unsigned long long deadline_misses;
+	unsigned long long deadline_p50_ns;
+	unsigned long long deadline_p99_ns;
+	unsigned long long wake_p50_ns;
+	unsigned long long wake_p99_ns;
+	unsigned long long drain_p99_ns;
+	unsigned long long preempted_holds;
+	double preempt_held_pct;
+	double preempt_lost_pct;
+};
+
+/* Run the benchmark in a child with the current parameters */
+static void run_child(struct sweep_result *res)
+{
+	struct cpu_times before, after;
+	struct rusage ru;
+	unsigned long long total;
+	int pipefd[2];
+	int status, i;
+	pid_t pid;
+
+	if (pipe(pipefd)) {
+		perror("pipe");
+		exit(1);
+	}
+
+	fflush(stdout);
+	read_proc_stat(&before);
+
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		exit(1);
+	}
+
+	if (!pid) {
+		close(pipefd[0]);
+		if (!freopen("/dev/null", "w", stdout))
+			exit(1);
+		run_benchmark();
+
+		res->entries = critical_section_entries;
+		res->hold_p50_ns = hist_percentile(&hold_hist, 50);
+		res->isolated_hold_ns = isolated_hold_ns;
+		for (i = 0; i < nr_threads; i++) {
+			res->cas_attempts += futex_stats[i].cas_attempts;
+			res->cas_failures += futex_stats[i].cas_failures;
+		}
+		if (measure_wait) {
+			struct lat_hist *all = malloc(sizeof(*all));
+
+			if (!all)
+				exit(1);
+			merge_acquire_latency(all);
+			res->wait_p50_ns = hist_percentile(all, 50);
+			res->wait_p99_ns = hist_percentile(all, 99);
+			res->wait_p999_ns = hist_percentile(all, 99.9);
+		}
+		if (detect_preempt) {
+			struct preempt_stats total;
+			double lost;
+
+			merge_preempt_stats(&total);
+			lost = preempt_lost_entries(&total);
+			res->preempted_holds = total.long_holds;
+			res->preempt_held_pct = 100.0 * total.long_hold_ns /
+				((double) timeout * NSECS_PER_SEC);
+			res->preempt_lost_pct = critical_section_entries ?
+				100.0 * lost / (critical_section_entries + lost) : 0;
+		}
+		if (wake_stats) {
+			struct lat_hist *all = malloc(sizeof(*all));
+
+			if (!all)
+				exit(1);
+			merge_wake_stats(all);
+			res->wake_p50_ns = hist_percentile(all, 50);
+			res->wake_p99_ns = hist_percentile(all, 99);
+			res->drain_p99_ns = hist_percentile(drain_hist, 99);
+		}
+		if (deadline_ns) {
+			struct deadline_stats *all = malloc(sizeof(*all));
+
+			if (!all)
+				exit(1);
+			merge_deadline_stats(all);
+			res->deadline_attempts = all->attempts;
+			res->deadline_misses = all->misses;
+			res->deadline_p50_ns = hist_percentile(&all->acquired, 50);
+			res->deadline_p99_ns = hist_percentile(&all->acquired, 99);
+		}
+
+		if (write(pipefd[1], res, sizeof(*res)) != sizeof(*res))
+			exit(1);
+		exit(0);
+	}
+
+	close(pipefd[1]);
+	if (read(pipefd[0], res, sizeof(*res)) != sizeof(*res))
+		res->entries = 0;
+	close(pipefd[0]);
+
+	if (wait4(pid, &status, 0, &ru) != pid ||
+	    !WIFEXITED(status) || WEXITSTATUS(status)) {
+		printf("Benchmark run failed\n");
+		exit(1);
+	}
+	read_proc_stat(&after);
+
+	total = after.total - before.total;
+	if (!total)
+		total = 1;
+	res->usr_pct = 100.0 * (after.usr - before.usr) / total;
+	res->sys_pct = 100.0 * (after.sys - before.sys) / total;
+	res->idle_pct = 100.0 * (after.idle - before.idle) / total;
+	res->cpu_secs = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+		(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+/* SLO columns of the -c/-r and thread sweeps with --deadline-us */
+static void print_deadline_header(void)
+{
+	if (deadline_ns)
+		printf("    Miss%%   OK p50(ns)   OK p99(ns)");
+}
+
+static void print_deadline_columns(struct sweep_result *res)
+{
+	if (!deadline_ns)
+		return;
+
+	printf("  %7.3f  %10lld  %10lld",
+		res->deadline_attempts ?
+		100.0 * res->deadline_misses / res->deadline_attempts : 0,
+		res->deadline_p50_ns, res->deadline_p99_ns);
+}
+
+/* Wake latency columns of the thread sweep with the wake patterns */
+static int sweep_wakes(void)
+{
+	return exec_mode->print_summary == print_wake_summary;
+}
+
+static void print_wake_header(void)
+{
+	if (sweep_wakes())
+		printf("  Wake p50(ns)  Wake p99(ns)  Drain p99(ns)");
+}
+
+static void print_wake_columns(struct sweep_result *res)
+{
+	if (!sweep_wakes())
+		return;
+
+	printf("  %12lld  %12lld  %13lld", res->wake_p50_ns,
+		res->wake_p99_ns, res->drain_p99_ns);
+}
+
+static double sweep_efficiency(struct sweep_result *res)
+{
+	return res->cpu_secs ? res->entries / res->cpu_secs : 0;
+}
+
+static void run_sweep(void)
+{
+	struct sweep_result res[256];
+	unsigned long long c, r;
+	int nr, i;
+
+	/* A dimension that is not swept uses the -c or -r value */
+	if (!sweep_crittime.step) {
+		sweep_crittime.start = sweep_crittime.end = critical_section_time_ns;
+		sweep_crittime.step = 1;
+	}
+
+	if (!sweep_retry.step) {
+		sweep_retry.start = sweep_retry.end = fwait_retry_count;
+		sweep_retry.step = 1;
+	}
+
+	printf("Lock = %s, %d threads, %lu seconds per run\n",
+		lock_ops->name, nr_threads, timeout);
+	if (deadline_ns)
+		printf("Deadline = %lld us\n", deadline_ns / NSECS_PER_USEC);
+	printf(" Crittime(ns)  Retry-count    Num CS/s    %%Usr    %%Sys   %%Idle     CPU-s    CS/CPU-s");
+	print_deadline_header();
+	printf("  Best\n");
+	printf(" ================================================================================================\n");
+
+	for (c = sweep_crittime.start; c <= sweep_crittime.end;
+	     c = range_next(&sweep_crittime, c)) {
+		int best_tput = -1, best_eff = -1;
+
+		nr = 0;
+		for (r = sweep_retry.start; r <= sweep_retry.end && nr < 256;
+		     r = range_next(&sweep_retry, r)) {
+			critical_section_time_ns = c;
+			fwait_retry_count = r;
+			res[nr].crittime = c;
+			res[nr].retry = r;
+			run_child(&res[nr]);
+
+			if (best_tput < 0 ||
+			    res[nr].entries > res[best_tput].entries)
+				best_tput = nr;
+			if (best_eff < 0 ||
+			    sweep_efficiency(&res[nr]) >
+			    sweep_efficiency(&res[best_eff]))
+				best_eff = nr;
+			nr++;
+		}
+
+		for (i = 0; i < nr; i++) {
+			printf(" %12lld  %11lld  %10.0f  %6.2f  %6.2f  %6.2f  %8.2f  %10.0f",
+				res[i].crittime, res[i].retry,
+				(double) res[i].entries / timeout,
+				res[i].usr_pct, res[i].sys_pct,
+				res[i].idle_pct, res[i].cpu_secs,
+				sweep_efficiency(&res[i]));
+			print_deadline_columns(&res[i]);
+			printf("  %s%s\n",
+				i == best_tput ? "T" : "",
+				i == best_eff ? "E" : "");
+		}
+
+		printf(" Crittime %lld ns : best throughput at -r %lld, best CPU efficiency at -r %lld\n",
+			c, res[best_tput].retry, res[best_eff].retry);
+	}
+}
+
+/***********************************************************************
+ * Thread count sweep with a Universal Scalability Law fit
+ *
+ * Runs the benchmark with 1 up to -n threads, either every count or
+ * powers of two (plus -n itself), and fits the throughput X(N) to the
+ * Universal Scalability Law (Gunther):
+ *
+ *   X(N) = X(1) * N / (1 + sigma * (N - 1) + kappa * N * (N - 1))
+ *
+ * sigma is the contention (serialization) coefficient and kappa the
+ * coherency (crosstalk) coefficient. With C(N) = X(N) / X(1), the
+ * model is linear in the coefficients :
+ *
+ *   N / C(N) - 1 = sigma * (N - 1) + kappa * N * (N - 1)
+ *
+ * so they are obtained by least squares without an intercept. When
+ * kappa > 0 throughput peaks at N* = sqrt((1 - sigma) / kappa) and
+ * declines beyond.
+ ***********************************************************************/
+static double usl_throughput(double x1, double sigma, double kappa, double n)
+{
+	return x1 * n / (1 + sigma * (n - 1) + kappa * n * (n - 1));
+}
+
+static void run_thread_sweep(void)
+{
+	int max_threads = nr_threads;
+	struct sweep_result *res;
+	int counts[MAX_THREADS];
+	double saa = 0, sab = 0, sbb = 0, say = 0, sby = 0, det;
+	double x1, sigma = 0, kappa = 0;
+	int nr = 0, peak = 0, i, n;
+
+	for (n = 1; n <= max_threads;
+	     n = (thread_sweep == THREAD_SWEEP_POW2) ? n * 2 : n + 1)
+		counts[nr++] = n;
+	if (counts[nr - 1] != max_threads)
+		counts[nr++] = max_threads;
+
+	res = calloc(nr, sizeof(*res));
+	if (!res) {
+		perror("calloc");
+		exit(1);
+	}
+
+	printf("Lock = %s, crittime = %lld ns, %lu seconds per run\n",
+		lock_ops->name, critical_section_time_ns, timeout);
+	if (deadline_ns)
+		printf("Deadline = %lld us\n", deadline_ns / NSECS_PER_USEC);
+	printf(" Threads     Num CS/s   Speedup    %%Usr    %%Sys   %%Idle");
+	print_wake_header();
+	print_deadline_header();
+	printf("\n");
+	printf(" ==========================================================\n");
+
+	for (i = 0; i < nr; i++) {
+		nr_threads = counts[i];
+		run_child(&res[i]);
+		if (res[i].entries > res[peak].entries)
+			peak = i;
+
+		printf(" %7d  %11.0f  %8.3f  %6.2f  %6.2f  %6.2f",
+			counts[i], (double) res[i].entries / timeout,
+			res[0].entries ?
+			(double) res[i].entries / res[0].entries : 0,
+			res[i].usr_pct, res[i].sys_pct, res[i].idle_pct);
+		print_wake_columns(&res[i]);
+		print_deadline_columns(&res[i]);
+		printf("\n");
+	}
+
+	x1 = (double) res[0].entries / timeout;
+	for (i = 1; i < nr; i++) {
+		double c = (double) res[i].entries / res[0].entries;
+		double a = counts[i] - 1;
+		double b = (double) counts[i] * (counts[i] - 1);
+		double y;
+
+		if (!res[i].entries)
+			continue;
+
+		y = counts[i] / c - 1;
+		saa += a * a;
+		sab += a * b;
+		sbb += b * b;
+		say += a * y;
+		sby += b * y;
+	}
+
+	det = saa * sbb - sab * sab;
+	if (!res[0].entries || det == 0) {
+		printf("Not enough data points for the USL fit\n");
+		free(res);
+		return;
+	}
+
+	sigma = (say * sbb - sby * sab) / det;
+	kappa = (saa * sby - sab * say) / det;
+
+	printf("Measured peak = %6.6f M entries/s at %d threads\n",
+		(double) res[peak].entries / timeout / 1000000, counts[peak]);
+	if (peak != nr - 1) {
+		printf("Measured throughput at %d threads = %6.2f%% of peak\n",
+			counts[nr - 1],
+			100.0 * res[nr - 1].entries / res[peak].entries);
+	}
+
+	printf("USL fit : sigma (contention) = %.6f, kappa (coherency) = %.8f\n",
+		sigma, kappa);
+
+	if (kappa > 0 && sigma < 1) {
+		double nstar = sqrt((1 - sigma) / kappa);
+		double xpeak = usl_throughput(x1, sigma, kappa, nstar);
+
+		printf("USL peak = %6.6f M entries/s at %.1f threads\n",
+			xpeak / 1000000, nstar);
+		printf("USL throughput at 2x peak threads (%.0f) = %6.2f%% of peak\n",
+			2 * nstar,
+			100.0 * usl_throughput(x1, sigma, kappa, 2 * nstar) / xpeak);
+	} else if (sigma >= 1 || peak == 0) {
+		printf("USL fit is contention-bound, peak at N=1 : %6.6f M entries/s\n",
+			x1 / 1000000);
+	} else {
+		printf("USL predicts no peak : throughput approaches %6.6f M entries/s\n",
+			sigma > 0 ? x1 / sigma / 1000000 : INFINITY);
+	}
+
+	free(res);
+}
+
+/***********************************************************************
+ * Think time sweep
+ *
+ * Runs the benchmark once for every mean think time in --sweep-think,
+ * using the --think distribution (exponential by default), to show
+ * throughput and wait time percentiles as a function of the offered
+ * load, and so where the lock saturates.
+ ***********************************************************************/
+
+static void run_think_sweep(void)
+{
+	struct sweep_result res;
+	struct dist base;
+	unsigned long long t;
+	double offered, mean_crit, base_mean;
+
+	if (think_dist.type == DIST_NONE)
+		think_dist.type = DIST_EXP;
+	measure_wait = 1;
+
+	/* A bimodal --think keeps its shape, both modes are scaled to t */
+	base = think_dist;
+	base_mean = dist_mean(&base);
+
+	mean_crit = crit_dist.type == DIST_NONE ?
+		critical_section_time_ns : dist_mean(&crit_dist);
+
+	printf("Lock = %s, %d threads, crittime = %.0f ns, arrivals = %s, %lu seconds per run\n",
+		lock_ops->name, nr_threads, mean_crit,
+		arrivals == ARRIVALS_OPEN ? "open" : "closed", timeout);
+	printf("   Think(ns)  Offered(req/s)   Util%%     Num CS/s   Wait p50(ns)   Wait p99(ns)  Wait p99.9(ns)\n");
+	printf(" ==================================================================================================\n");
+
+	for (t = sweep_think.start; t <= sweep_think.end;
+	     t = range_next(&sweep_think, t)) {
+		if (think_dist.type == DIST_BIMODAL && base_mean > 0) {
+			think_dist.a = base.a * t / base_mean;
+			think_dist.b = base.b * t / base_mean;
+		} else {
+			think_dist.a = think_dist.b = t;
+		}
+
+		memset(&res, 0, sizeof(res));
+		res.think_ns = t;
+		run_child(&res);
+
+		offered = offered_load();
+		printf(" %11lld  %14.0f  %6.2f  %11.0f  %13lld  %13lld  %14lld\n",
+			t, offered, offered * mean_crit / NSECS_PER_SEC * 100,
+			(double) res.entries / timeout, res.wait_p50_ns,
+			res.wait_p99_ns, res.wait_p999_ns);
+	}
+}
+
+/***********************************************************************
+ * Placement sweep
+ *
+ * With --placement=all, runs the benchmark once per placement policy
+ * (and once unpinned) and prints the throughput of each along with the
+ * CPUs, cores and nodes that the threads were spread over.
+ ***********************************************************************/
+
+static void run_placement_sweep(void)
+{
+	struct sweep_result res;
+	int cpus, cores, nodes;
+
+	printf("Lock = %s, %d threads, crittime = %lld ns, %lu seconds per run\n",
+		lock_ops->name, nr_threads, critical_section_time_ns, timeout);
+	printf(" Placement      CPUs  Cores  Nodes     Num CS/s    %%Usr     %%Sys    %%Idle\n");
+	printf(" ==========================================================================\n");
+
+	for (placement = 0; placement < NR_PLACEMENTS; placement++) {
+		build_placement();
+		placement_span(&cpus, &cores, &nodes);
+
+		memset(&res, 0, sizeof(res));
+		run_child(&res);
+
+		if (placement == PLACEMENT_NONE)
+			printf(" %-13s  %4s  %5s  %5s", placement_names[placement],
+				"-", "-", "-");
+		else
+			printf(" %-13s  %4d  %5d  %5d", placement_names[placement],
+				cpus, cores, nodes);
+		printf("  %11.0f  %6.2f   %6.2f   %6.2f\n",
+			(double) res.entries / timeout, res.usr_pct,
+			res.sys_pct, res.idle_pct);
+	}
+}
+
+/***********************************************************************
+ * Backoff sweep
+ *
+ * With --sweep-backoff, runs the benchmark once per fwait backoff
+ * policy and prints the throughput, the CAS failure rate and the hold
+ * inflation of each. With --detect-preempt (or -n <k>x), the
+ * preempted holds and the throughput they cost are added. Combined with --placement=smt-siblings, where
+ * the waiters spin on the SMT siblings of the holder, against
+ * --placement=one-per-core, this shows how much each policy slows
+ * down the holder.
+ ***********************************************************************/
+
+static void run_backoff_sweep(void)
+{
+	struct sweep_result res;
+
+	print_futex_stats = 1;
+
+	printf("Lock = %s, %d threads, crittime = %lld ns, retries = %lu, placement = %s, %lu seconds per run\n",
+		lock_ops->name, nr_threads, critical_section_time_ns,
+		fwait_retry_count, placement_names[placement], timeout);
+	printf(" Backoff           Num CS/s   CAS fail%%   Hold p50(ns)   Isolated(ns)   Inflation");
+	if (detect_preempt)
+		printf("   Preempted   Held%%   Lost%%");
+	printf("\n");
+	printf(" ==================================================================================\n");
+
+	for (backoff = 0; backoff < sizeof(backoff_names) / sizeof(backoff_names[0]);
+	     backoff++) {
+		memset(&res, 0, sizeof(res));
+		run_child(&res);
+
+		printf(" %-13s  %11.0f  %9.2f  %13lld  %13lld  %9.3fx",
+			backoff_names[backoff], (double) res.entries / timeout,
+			res.cas_attempts ?
+			100.0 * res.cas_failures / res.cas_attempts : 0,
+			res.hold_p50_ns, res.isolated_hold_ns,
+			res.isolated_hold_ns ?
+			(double) res.hold_p50_ns / res.isolated_hold_ns : 0);
+		if (detect_preempt)
+			printf("  %10lld  %6.2f  %6.2f", res.preempted_holds,
+				res.preempt_held_pct, res.preempt_lost_pct);
+		printf("\n");
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	init_thread_sched();
+	init_allowed_cpus();
+	parse_args(argc, argv);
+	setpgid(getpid(), getpid());
+	init_cpu_node_map();
+	init_cpu_topology();
+	build_placement();
+	calibrate_spin();
+	calibrate_cpu_clock();
+	init_cs_data();
+
+	if (thread_sweep) {
+		run_thread_sweep();
+		return 0;
+	}
+
+	if (sweep_think.step) {
+		run_think_sweep();
+		return 0;
+	}
+
+	if (placement_sweep) {
+		run_placement_sweep();
+		return 0;
+	}
+
+	if (backoff_sweep) {
+		run_backoff_sweep();
+		return 0;
+	}
+
+	if (sweep_mode) {
+		run_sweep();
+		return 0;
+	}
+
+	run_benchmark();
+	print_results();
 
 	return 0;
 }